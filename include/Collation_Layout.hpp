@@ -0,0 +1,127 @@
+
+#ifndef COLLATION_LAYOUT_HPP
+#define COLLATION_LAYOUT_HPP
+
+
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <typeinfo>
+
+
+// =============================================================================
+
+namespace key_value_collator
+{
+
+
+// Layout of a collated key-value collection on disk: where the sorted pairs of
+// each partition are. It is shared by all the readers of a collation.
+struct Collation_Layout
+{
+    std::vector<std::string> path;  // `path[i]` is the path to the file containing the partition `i`.
+    std::vector<uint64_t> file_offset;  // `file_offset[i]` is the byte-offset of the partition `i` into its file.
+    std::vector<std::size_t> pair_offset;   // `pair_offset[i]` is the index of the first pair of partition `i`; the last entry is the total pair-count.
+    bool read_once = false; // Whether the pairs are read once, so that the readers drop the pages read from the page cache.
+
+
+    // Returns the number of partitions.
+    std::size_t partition_count() const { return path.size(); }
+
+    // Returns the total number of key-value pairs.
+    std::size_t pair_count() const { return pair_offset.back(); }
+
+    // Returns the number of key-value pairs in the partition `p_id`.
+    std::size_t partition_size(const std::size_t p_id) const { return pair_offset[p_id + 1] - pair_offset[p_id]; }
+};
+
+
+// A collation exported into a single file has this header at its beginning,
+// followed by a directory of `partition_count` entries, and then the sorted
+// pairs of each partition, starting at page-aligned offsets. A manifest of a
+// persisted collation has the same header and directory, followed by a table
+// of `partition_count` null-terminated paths to the files of the partitions.
+struct Collation_File_Header
+{
+    char magic[8];  // Identifier of the file format: `collation_file_magic`.
+    uint32_t version;   // Version of the file format.
+    uint32_t key_size;  // Size of a key in bytes.
+    uint32_t val_size;  // Size of a value in bytes.
+    uint32_t pair_size; // Size of a key-value pair in bytes.
+    uint64_t key_type_id;   // Identifier of the key type; see `type_id`.
+    uint64_t val_type_id;   // Identifier of the value type.
+    uint64_t hasher_type_id;    // Identifier of the hasher type partitioning the keys.
+    uint64_t path_table_size;   // Size of the path table in bytes; 0 if the partitions are in this file.
+    uint64_t partition_count;   // Number of partitions.
+    uint64_t pair_count;    // Total number of key-value pairs.
+    uint64_t aggregated;    // Whether the aggregate statistics below are computed.
+    uint64_t unique_key_count;  // Number of unique keys.
+    uint64_t mode_count;    // Number of pairs with a most frequent key.
+};
+
+
+// An entry of the partition directory of a single-file collation.
+struct Collation_File_Dir_Entry
+{
+    uint64_t offset;    // Byte-offset of the partition's pairs into the file.
+    uint64_t pair_count;    // Number of key-value pairs in the partition.
+};
+
+
+// A checkpoint of an interrupted collation has this header at its beginning,
+// followed by an entry per partition.
+struct Collation_Checkpoint_Header
+{
+    char magic[8];  // Identifier of the file format: `collation_checkpoint_magic`.
+    uint32_t version;   // Version of the file format.
+    uint32_t pair_size; // Size of a key-value pair in bytes.
+    uint64_t key_type_id;   // Identifier of the key type; see `type_id`.
+    uint64_t val_type_id;   // Identifier of the value type.
+    uint64_t hasher_type_id;    // Identifier of the hasher type partitioning the keys.
+    uint64_t partition_count;   // Number of partitions.
+    uint64_t phase; // Phase of the collation reached: `collation_phase_deposited` or `collation_phase_collating`.
+    uint64_t output_format; // Output format of the collation, once collating.
+    uint64_t single_file;   // Whether the collation is into a single file, once collating.
+    uint64_t aggregate; // Whether the collation aggregates the keys, once collating.
+};
+
+
+// An entry of a collation checkpoint, for a partition.
+struct Collation_Checkpoint_Entry
+{
+    uint64_t collated;  // Whether the partition has been collated and written durably.
+    uint64_t pair_count;    // Number of key-value pairs in the partition.
+    uint64_t unique_key_count;  // Number of unique keys in the partition, if aggregated.
+    uint64_t mode_count;    // Number of pairs with a most frequent key in the partition, if aggregated.
+    uint64_t split; // Whether the partition was split into child runs during the deposits.
+};
+
+
+constexpr char collation_file_magic[8] = {'K', 'V', 'C', 'O', 'L', 'L', 'A', 'T'};
+constexpr uint32_t collation_file_version = 1;
+constexpr char collation_checkpoint_magic[8] = {'K', 'V', 'C', 'K', 'P', 'T', '\0', '\0'};
+constexpr uint32_t collation_checkpoint_version = 2;
+constexpr uint64_t collation_phase_deposited = 1;   // The deposit stream has been closed, and the partitions are durable.
+constexpr uint64_t collation_phase_collating = 2;   // The partitions are being collated.
+constexpr std::size_t collation_file_align = 4096;  // Alignment of the partitions in a single-file collation.
+
+
+// Returns an identifier of the type `T_` that is stable across processes of
+// the same ABI: the FNV-1a hash of its mangled name.
+template <typename T_>
+inline uint64_t type_id()
+{
+    uint64_t h = 14695981039346656037ull;
+    for(const char* c = typeid(T_).name(); *c != '\0'; ++c)
+        h = (h ^ static_cast<unsigned char>(*c)) * 1099511628211ull;
+
+    return h;
+}
+
+}
+
+
+
+#endif
@@ -0,0 +1,104 @@
+
+#ifndef IO_RATE_LIMITER_HPP
+#define IO_RATE_LIMITER_HPP
+
+
+
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+
+namespace key_value_collator
+{
+
+
+// A token bucket limiting the bandwidth of some I/O, in bytes per second,
+// shared by the threads doing the I/O. The bucket holds the bandwidth of
+// `burst_sec` seconds. A request takes its bytes from the bucket and goes
+// through, leaving it in debt if need be; the next requests wait until the
+// debt is paid back. So requests of any size are admitted, at the rate in
+// the long run.
+class IO_Rate_Limiter
+{
+private:
+
+    static constexpr double burst_sec = 0.1;    // Seconds of bandwidth the bucket holds.
+
+    std::size_t rate;   // Bandwidth limit in bytes per second; 0 if unlimited.
+    double tokens;  // Bytes available in the bucket; negative if in debt.
+    std::chrono::steady_clock::time_point last_fill;    // Time of the latest filling of the bucket.
+
+    std::atomic<uint64_t> byte_count;   // Number of bytes requested.
+    std::atomic<uint64_t> throttle_ns;  // Total time the requests have waited, in nanoseconds.
+
+    std::mutex mtx; // Mutex for the bucket.
+
+
+public:
+
+    // Constructs an unlimited rate limiter.
+    IO_Rate_Limiter(): rate(0), tokens(0), byte_count(0), throttle_ns(0) {}
+
+    // Sets the bandwidth limit to `bytes_per_sec`; 0 lifts the limit.
+    void set_rate(std::size_t bytes_per_sec);
+
+    // Requests `bytes` bytes of I/O; waits until it is within the limit.
+    void acquire(std::size_t bytes);
+
+    // Returns the number of bytes requested.
+    uint64_t bytes() const { return byte_count; }
+
+    // Returns the total time the requests have waited, in seconds.
+    double throttle_time() const { return throttle_ns / 1e9; }
+};
+
+
+inline void IO_Rate_Limiter::set_rate(const std::size_t bytes_per_sec)
+{
+    std::lock_guard<std::mutex> guard(mtx);
+    rate = bytes_per_sec;
+    tokens = rate * burst_sec;
+    last_fill = std::chrono::steady_clock::now();
+}
+
+
+inline void IO_Rate_Limiter::acquire(const std::size_t bytes)
+{
+    byte_count += bytes;
+
+    std::chrono::nanoseconds wait(0);
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        if(rate == 0)
+            return;
+
+        const auto now = std::chrono::steady_clock::now();
+        const double elapsed = std::chrono::duration<double>(now - last_fill).count();
+        tokens = std::min(tokens + elapsed * rate, rate * burst_sec);
+        last_fill = now;
+
+        // The request waits out the debt before it, and leaves its own to the next ones.
+        if(tokens < 0)
+            wait = std::chrono::nanoseconds(static_cast<int64_t>(-tokens / rate * 1e9));
+
+        tokens -= bytes;
+    }
+
+    if(wait.count() > 0)
+    {
+        std::this_thread::sleep_for(wait);
+        throttle_ns += wait.count();
+    }
+}
+
+
+}
+
+
+
+#endif
@@ -0,0 +1,229 @@
+
+#ifndef KEY_VALUE_BATCH_READER_HPP
+#define KEY_VALUE_BATCH_READER_HPP
+
+
+
+#include "Collation_Layout.hpp"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <utility>
+#include <algorithm>
+#include <cstdlib>
+#include <cerrno>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+// =============================================================================
+
+namespace key_value_collator
+{
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_> class Key_Value_Collator;
+
+
+// A class to read key-value pairs of type `(T_key_, T_val_)`, collated by the
+// class `Key_Value_Collator`, in batches from multiple threads. The collection
+// is split into chunks, each within a single partition, and the chunks are
+// handed out to the readers in order through an atomic cursor. Each reader
+// then reads in its chunk independently, so no lock is held during I/O.
+template <typename T_key_, typename T_val_>
+class Key_Value_Batch_Reader
+{
+    template <typename, typename> friend class Key_Value_Shared_Scan;
+
+    typedef std::pair<T_key_, T_val_> key_val_pair_t;
+
+public:
+
+    // A chunk of the collection: `count` pairs of the partition `p_id`,
+    // starting at its pair-index `offset`.
+    struct Chunk
+    {
+        std::size_t p_id;
+        std::size_t offset;
+        std::size_t count;
+    };
+
+
+private:
+
+    const std::shared_ptr<const Collation_Layout> layout;   // Layout of the collated partitions on disk.
+    const std::size_t chunk_sz; // Maximum number of pairs in a chunk.
+
+    std::vector<std::size_t> chunk_offset;  // `chunk_offset[i]` is the index of the first chunk of partition `i`; the last entry is the total chunk-count.
+    std::vector<int> fd;    // `fd[i]` is the file-descriptor of the partition `i`; partitions in the same file share it.
+
+    std::atomic<std::size_t> cursor;    // Index of the next chunk to hand out.
+
+    static constexpr std::size_t chunk_sz_default = 5lu * 1024lu * 1024lu / sizeof(key_val_pair_t);  // Default chunk size in elements: total 5MB.
+
+
+public:
+
+    Key_Value_Batch_Reader(const Key_Value_Batch_Reader&) = delete;
+    Key_Value_Batch_Reader& operator=(const Key_Value_Batch_Reader&) = delete;
+
+    // Constructs a batch reader over the collated collection with the on-disk
+    // layout `layout`, handing out chunks of at most `chunk_sz` pairs.
+    Key_Value_Batch_Reader(std::shared_ptr<const Collation_Layout> layout, std::size_t chunk_sz = chunk_sz_default);
+
+    // Constructs a batch reader over the collated collection of `collator`,
+    // handing out chunks of at most `chunk_sz` pairs.
+    template <typename T_hasher_>
+    Key_Value_Batch_Reader(const Key_Value_Collator<T_key_, T_val_, T_hasher_>& collator, std::size_t chunk_sz = chunk_sz_default):
+        Key_Value_Batch_Reader(collator.collation_layout(), chunk_sz)
+    {}
+
+    ~Key_Value_Batch_Reader();
+
+    // Returns the maximum number of pairs in a chunk.
+    std::size_t chunk_size() const { return chunk_sz; }
+
+    // Tries to fetch the next unread chunk into `chunk`. Returns `true` iff
+    // such a chunk is found. It is thread-safe and lock-free.
+    bool next_chunk(Chunk& chunk);
+
+    // Reads in the pairs of the chunk `chunk` into `buf`. Returns the number
+    // of pairs read. It is thread-safe.
+    std::size_t read(const Chunk& chunk, key_val_pair_t* buf) const;
+
+    // Tries to read in the next unread chunk into `buf`, which must have space
+    // for `chunk_size()` pairs. Returns the number of pairs read, which is 0
+    // in case when the end of the collection has been reached. It is thread-
+    // safe.
+    std::size_t read(key_val_pair_t* buf);
+};
+
+
+template <typename T_key_, typename T_val_>
+inline Key_Value_Batch_Reader<T_key_, T_val_>::Key_Value_Batch_Reader(std::shared_ptr<const Collation_Layout> layout, const std::size_t chunk_sz):
+    layout(std::move(layout)),
+    chunk_sz(chunk_sz),
+    cursor(0)
+{
+    if(this->layout == nullptr || chunk_sz == 0)
+    {
+        std::cerr << "Batch reader requires a collated collection of pairs and a non-zero chunk size. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    const std::size_t partition_count = this->layout->partition_count();
+    chunk_offset.resize(partition_count + 1, 0);
+    fd.resize(partition_count, -1);
+    for(std::size_t p_id = 0; p_id < partition_count; ++p_id)
+    {
+        const std::size_t p_size = this->layout->partition_size(p_id);
+        chunk_offset[p_id + 1] = chunk_offset[p_id] + (p_size + chunk_sz - 1) / chunk_sz;
+
+        if(p_size == 0)
+            continue;
+
+        const std::string& path = this->layout->path[p_id];
+        for(std::size_t q_id = p_id; q_id-- > 0; )  // Reuse the descriptor of a preceding partition in the same file.
+            if(fd[q_id] >= 0)
+            {
+                if(this->layout->path[q_id] == path)
+                    fd[p_id] = fd[q_id];
+
+                break;
+            }
+
+        if(fd[p_id] < 0)
+        {
+            fd[p_id] = open(path.c_str(), O_RDONLY);
+            if(fd[p_id] < 0)
+            {
+                std::cerr << "Error opening partition files. Aborting.\n";
+                std::exit(EXIT_FAILURE);
+            }
+        }
+    }
+}
+
+
+template <typename T_key_, typename T_val_>
+inline Key_Value_Batch_Reader<T_key_, T_val_>::~Key_Value_Batch_Reader()
+{
+    int last_fd = -1;   // Partitions sharing a descriptor are consecutive among the non-empty ones.
+    for(const int f : fd)
+        if(f >= 0 && f != last_fd)
+        {
+            close(f);
+            last_fd = f;
+        }
+}
+
+
+template <typename T_key_, typename T_val_>
+inline bool Key_Value_Batch_Reader<T_key_, T_val_>::next_chunk(Chunk& chunk)
+{
+    if(cursor.load(std::memory_order_relaxed) >= chunk_offset.back())   // To avoid unbounded growth of the cursor.
+        return false;
+
+    const std::size_t c_id = cursor.fetch_add(1, std::memory_order_relaxed);
+    if(c_id >= chunk_offset.back())
+        return false;
+
+    // The partition containing the chunk is the last one starting at or before it.
+    const std::size_t p_id = std::upper_bound(chunk_offset.cbegin(), chunk_offset.cend(), c_id) - chunk_offset.cbegin() - 1;
+    const std::size_t p_size = layout->partition_size(p_id);
+
+    chunk.p_id = p_id;
+    chunk.offset = (c_id - chunk_offset[p_id]) * chunk_sz;
+    chunk.count = std::min(chunk_sz, p_size - chunk.offset);
+
+    return true;
+}
+
+
+template <typename T_key_, typename T_val_>
+inline std::size_t Key_Value_Batch_Reader<T_key_, T_val_>::read(const Chunk& chunk, key_val_pair_t* const buf) const
+{
+    char* const dst = reinterpret_cast<char*>(buf);
+    const std::size_t bytes = chunk.count * sizeof(key_val_pair_t);
+    const off_t offset = layout->file_offset[chunk.p_id] + chunk.offset * sizeof(key_val_pair_t);
+
+    std::size_t bytes_read = 0;
+    while(bytes_read < bytes)
+    {
+        const ssize_t r = pread(fd[chunk.p_id], dst + bytes_read, bytes - bytes_read, offset + bytes_read);
+        if(r <= 0)
+        {
+            if(r < 0 && errno == EINTR)
+                continue;
+
+            std::cerr << "Error reading the partition files. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        bytes_read += r;
+    }
+
+    return chunk.count;
+}
+
+
+template <typename T_key_, typename T_val_>
+inline std::size_t Key_Value_Batch_Reader<T_key_, T_val_>::read(key_val_pair_t* const buf)
+{
+    Chunk chunk;
+    return next_chunk(chunk) ? read(chunk, buf) : 0;
+}
+
+
+template <typename T_key_, typename T_val_>
+const std::size_t Key_Value_Batch_Reader<T_key_, T_val_>::chunk_sz_default;
+
+}
+
+
+
+#endif
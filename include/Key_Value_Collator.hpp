@@ -5,7 +5,15 @@
 
 
 #include "Spin_Lock.hpp"
+#include "IO_Rate_Limiter.hpp"
+#include "Collation_Layout.hpp"
 #include "Key_Value_Iterator.hpp"
+#include "Key_Value_Batch_Reader.hpp"
+#include "Key_Value_Shared_Scan.hpp"
+#include "Key_Value_Merge_Iterator.hpp"
+#include "Key_Value_Grouped_Partition.hpp"
+#include "Key_Value_Dataset.hpp"
+#include "Shared_Buffer_Pool.hpp"
 
 #include <sys/types.h>
 #include <cstdint>
@@ -17,11 +25,30 @@
 #include <cstdlib>
 #include <algorithm>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
 #include <fstream>
 #include <cstdio>
 #include <iostream>
 #include <thread>
+#include <memory>
 #include <cassert>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <climits>
+#include <pthread.h>
+#include <new>
+#include <iterator>
 
 
 // =============================================================================
@@ -31,6 +58,7 @@ namespace key_value_collator
 
 
 template <typename T_buf_> class Buffer_Pool;
+class Work_File_Remover;
 
 // A class to: collate a collection of key-value pairs, deposited from multiple
 // producers; and to iterate over the collated key-value collection. Keys are of
@@ -39,12 +67,72 @@ template <typename T_buf_> class Buffer_Pool;
 template <typename T_key_, typename T_val_, typename T_hasher_>
 class Key_Value_Collator
 {
+    template <typename, typename> friend class Key_Value_Grouped_Partition;
+
 public:
 
     typedef std::pair<T_key_, T_val_> key_val_pair_t;
     typedef std::vector<key_val_pair_t> buf_t;  // Type of the data buffers.
 
     typedef Key_Value_Iterator<T_key_, T_val_> iter_t;  // Type of the collation iterator.
+    typedef Key_Value_Batch_Reader<T_key_, T_val_> batch_reader_t;  // Type of the shared batched reader of the collation.
+    typedef Key_Value_Shared_Scan<T_key_, T_val_> shared_scan_t;    // Type of the scan of the collation shared among consumers.
+    typedef Key_Value_Merge_Iterator<T_key_, T_val_> ordered_iter_t;    // Type of the sorted-order collation iterator.
+    typedef Key_Value_Grouped_Partition<T_key_, T_val_> grouped_partition_t;    // Type of the view of a grouped collated partition.
+    typedef Key_Value_Dataset<T_key_, T_val_> dataset_t;    // Type of the reader of a persisted collation.
+
+    class Aggregate_Result;
+
+    // Formats of the collated output.
+    enum class Output_Format
+    {
+        pairs,      // Each partition is an array of its sorted key-value pairs.
+        grouped,    // Each partition is an array of its sorted unique keys, an array of the offsets of their values, and
+                    // an array of the values, i.e. in the CSR (compressed sparse row) form.
+    };
+
+    // Checkpointing modes of the collator.
+    enum class Checkpoint_Mode
+    {
+        off,    // No checkpoints are taken.
+        on,     // Checkpoints are taken once the deposit stream is closed, and after collating each partition.
+        resume, // Resumes an interrupted collation from its checkpoint, with no deposits; checkpoints are taken onwards.
+    };
+
+    // Policies on the page cache for the files of the collator.
+    enum class Page_Cache_Policy
+    {
+        keep,   // The pages are left to the kernel.
+        drop,   // The files are read and written once: the write-back of the spills and the collated partitions is
+                // started as they are written, and the pages are dropped once written back, or once read by the
+                // collation or the iterators; so that the collator does not evict the cache of the co-located work.
+    };
+
+    // Modes of spilling the partition buffers into the partition files.
+    enum class Spill_Mode
+    {
+        written,    // The buffers are in memory, and written into the files by the spill writers.
+        mapped,     // The buffers are windows of shared mappings of the files, and the pairs are mapped right into the
+                    // page cache; a spill unmaps the window, leaving its write-back to the kernel.
+    };
+
+    // I/O scheduling classes of the threads of the collator doing the I/O, as of `ioprio_set(2)`.
+    enum class IO_Priority_Class
+    {
+        none,           // The class follows the CPU scheduling priority of the thread.
+        realtime,       // The I/O is served first, at a priority level.
+        best_effort,    // The I/O is served at a priority level, fairly with the other best-effort ones.
+        idle,           // The I/O is served only when the disk is otherwise idle.
+    };
+
+    // Statistics of the I/O of the collator against its rate limits.
+    struct IO_Stats
+    {
+        uint64_t bytes_read;    // Number of bytes read by the collation.
+        uint64_t bytes_written; // Number of bytes spilled and written by the collation.
+        double read_throttle_time;  // Total time the reads have been held back by the read rate limit, in seconds.
+        double write_throttle_time; // Total time the writes have been held back by the write rate limit, in seconds.
+    };
 
 
 private:
@@ -52,42 +140,364 @@ private:
     const T_hasher_ hash;   // Hasher object to hash the keys to a numerical address-space.
 
     const std::string work_file_pref;   // Path to the temporary working files used by the collator.
+    const std::vector<std::string> stripe_pref; // Paths to the partition files, one per work directory; partition `i` is at `stripe_pref[i % stripe_pref.size()]`.
+    std::vector<std::string> output_pref;   // Paths to the collated partition files, one per output directory; empty if collated in place of the deposits.
 
     static constexpr char work_file_pref_default[] = ".";   // Default value for the temporary working files' prefixes.
     static constexpr char partition_file_ext[] = ".part";   // File extensions of the temporary partition files.
-
-    static constexpr std::size_t partition_count = (1 << 9);    // Number of partitions for the keys.
+    static constexpr char run_file_ext[] = ".run";  // File extensions of the runs of deposits to be merged into collated partitions.
+    static constexpr char split_file_ext[] = ".split";  // File extensions of the child runs of split partitions.
+    static constexpr char exchange_file_ext[] = ".xchg";    // File extensions of the pairs received from the other processes of an exchange.
+    static constexpr char dataset_file_ext[] = ".dataset";  // File extensions of the persisted partition files.
+    static constexpr char tail_file_ext[] = ".tail";    // File extensions of the last buffers of the partitions, flushed together at the close of a deposit stream.
+
+    static constexpr std::size_t partition_id_bits = 9; // Number of the hash bits addressing the partitions.
+    static constexpr std::size_t partition_count = (1 << partition_id_bits);    // Number of partitions for the keys.
     static constexpr std::size_t partition_buf_mem = (1LU * 1024 * 1024);   // Maximum memory for a partition buffer: 1MB.
     static constexpr std::size_t partition_buf_elem_th = partition_buf_mem / sizeof(key_val_pair_t);    // Maximum number of pairs to keep in a partition buffer.
 
-    std::vector<buf_t> partition_buf;   // `partition_buf[i]` is the in-memory buffer for partition `i`.
-    std::vector<std::ofstream> partition_file;  // `partition_file[i]` is the disk-storage file for partition `i`.
+    // The deposits are spilled through streams: the first `partition_count` ones are the runs of the partitions,
+    // and the rest are the child runs of the partitions split during the deposits; see `split_stream_id`.
+    static constexpr std::size_t split_fanout = (1 << 3);   // Number of child runs a partition is split into.
+    static constexpr std::size_t stream_count = partition_count * (1 + split_fanout);   // Number of spill streams.
+    static constexpr std::size_t partition_split_th_default = (1LU * 1024 * 1024 * 1024);  // Default spilled size to split a partition at: 1GB.
+
+    std::vector<key_val_pair_t*> partition_buf; // `partition_buf[i]` is the in-memory buffer for stream `i`; null until its first pair.
+    std::vector<std::size_t> partition_buf_size;    // `partition_buf_size[i]` is the number of pairs in the buffer of stream `i`.
+    std::vector<int> partition_fd;  // `partition_fd[i]` is the file-descriptor of the disk-storage file for stream `i`; -1 till its first flush.
+    Spill_Mode spill_mode;  // Mode of spilling the partition buffers.
+    std::vector<off_t> stream_file_size;    // `stream_file_size[i]` is the number of bytes spilled into the file of stream `i`, in the mapped mode.
+
+    std::size_t partition_split_th; // Spilled size of a partition in bytes to split it at; 0 if partitions are not split.
+    std::vector<std::size_t> partition_spill_bytes; // `partition_spill_bytes[i]` is the number of bytes spilled into the run of partition `i`.
+    std::vector<uint8_t> partition_split;   // `partition_split[i]` is whether the partition `i` is split into child runs.
+
+    std::vector<std::size_t> tail_count;    // `tail_count[i]` is the number of pairs of partition `i` in the tail file of its work directory, until collated.
+    std::vector<off_t> tail_offset; // `tail_offset[i]` is the byte-offset of the pairs of partition `i` into the tail file of its work directory.
+
+    std::size_t collate_mem_cap;    // Cap on the memory of the partitions being collated at once, in bytes; 0 if uncapped.
+
+    Page_Cache_Policy page_cache_policy;    // Policy on the page cache for the files of the collator.
+
+    IO_Rate_Limiter read_limiter;   // Limiter of the read bandwidth of the collation.
+    IO_Rate_Limiter write_limiter;  // Limiter of the write bandwidth of the spills and the collation.
+    std::atomic<int> io_prio;   // I/O priority of the threads doing the I/O, as encoded for `ioprio_set`; read by the spill writers as they run.
+    static constexpr int io_prio_class_shift = 13;  // Bit offset of the scheduling class in an encoded I/O priority, above the level.
+
+    std::string spill_tier_pref;    // Path-prefix of the partition files in the fast spill tier; empty if there is none.
+    std::size_t spill_tier_cap; // Capacity of the fast spill tier in bytes.
+    std::size_t fast_spill_bytes;   // Number of bytes spilled into the fast tier.
+    std::size_t disk_spill_bytes;   // Number of bytes spilled into the work directories.
+    std::vector<uint8_t> partition_overflow;    // `partition_overflow[i]` is whether partition `i` has overflowed the fast tier into its work directory.
+
+    std::size_t exchange_count; // Number of processes the collation is spread over; 1 if it is not.
+    std::size_t exchange_rank;  // Rank of this process among the ones the collation is spread over.
+    std::vector<int> exchange_fd;   // `exchange_fd[i]` is the socket to send the pairs of the partitions of process `i` into; -1 for this one.
+    std::vector<buf_t> exchange_buf;    // `exchange_buf[i]` has the pairs pending to be sent to process `i`.
+    std::vector<std::thread> exchange_receiver; // Threads receiving the pairs of the partitions of this process from the others.
+    static constexpr std::size_t exchange_timeout_sec = 60; // Seconds to wait for the other processes to join an exchange.
+    static constexpr std::size_t shared_channel_timeout_sec = 60;   // Seconds to wait for the producers of a shared deposit channel to return their buffers at the close of the stream.
+
+    static constexpr std::size_t slab_buf_count = 16;   // Number of partition buffers carved out of each slab.
+    std::vector<key_val_pair_t*> slab;  // The slabs of memory for the partition buffers, mapped as needed.
+    std::vector<key_val_pair_t*> free_partition_buf;    // Partition buffers available to be used.
+    Spin_Lock partition_buf_lock;   // Mutual-exclusion lock for the free partition buffers, returned by the spill writers.
+
+    class Spill_Writer;
+    std::vector<std::unique_ptr<Spill_Writer>> spill_writer;    // `spill_writer[i]` writes the spilled buffers of the partitions in work directory `i`.
 
     Buffer_Pool<buf_t*> buf_pool;   // Managed buffer collection to copy-in and process incoming data from the producers.
     const std::size_t buf_count;    // Number of concurrent buffers for the producers.
     static constexpr std::size_t buf_count_default = 16;    // Default value for the concurrent buffer count.
 
+    std::atomic<Shared_Buffer_Pool<T_key_, T_val_>*> shared_pool;  // Buffers of the producers in other processes, during the deposit stream; null if none.
+    static constexpr std::size_t shared_buf_capacity_default = (1 << 16);   // Default number of pairs in a buffer of the shared pool.
+
     std::thread* mapper;    // The background thread mapping key-value pairs to corresponding partitions.
     std::atomic<bool> stream_incoming;  // Flag denoting whether the incoming key-value streams have ended or not.
 
-
-    // Returns the disk-file path for the partition `p_id`.
+    std::shared_ptr<const Collation_Layout> layout; // Layout of the collated partitions on disk; null unless collated in the pairs format.
+
+    std::string output_file_path;   // Path to the single file the collation is exported into, if any.
+    int output_fd;  // File-descriptor of the single output file during collation.
+    std::vector<uint64_t> output_file_offset;   // `output_file_offset[i]` is the byte-offset of partition `i` into the single output file.
+    bool aggregated;    // Whether the aggregate result has been generated by the collation.
+    bool persisted; // Whether the collated partitions are to outlive the collator.
+    bool incremental;   // Whether the deposits are to be merged into the partitions of a previous collation.
+    static constexpr std::size_t merge_buf_elem_count = partition_buf_elem_th;  // Number of pairs in each buffer of a partition merge.
+    static constexpr std::size_t min_run_buf_elem_count = 64lu * 1024lu / sizeof(key_val_pair_t);  // Minimum number of pairs in the buffer of a run of a split partition's merge: 64KB.
+
+    const bool checkpointing;   // Whether checkpoints of the collation are taken.
+    int checkpoint_fd;  // File-descriptor of the checkpoint file, once one is taken.
+    Collation_Checkpoint_Header checkpoint_header;  // Header of the latest checkpoint.
+    std::vector<Collation_Checkpoint_Entry> checkpoint_entry;   // `checkpoint_entry[i]` is the checkpointed state of partition `i`.
+    static constexpr char checkpoint_file_ext[] = ".ckpt";  // File extension of the checkpoint file.
+
+    Output_Format output_format;    // Format of the collated output.
+    static constexpr char key_file_ext[] = ".keys"; // File extensions of the unique-key arrays of grouped partitions.
+    static constexpr char offset_file_ext[] = ".offs";  // File extensions of the value-offset arrays of grouped partitions.
+    static constexpr char val_file_ext[] = ".vals"; // File extensions of the value arrays of grouped partitions.
+
+
+    // Returns the path-prefix of the files of the partition `p_id`: in the
+    // fast spill tier, unless it has overflowed into the work directory it is
+    // striped onto.
+    const std::string& partition_pref(const std::size_t p_id) const
+    { return spill_tier_pref.empty() || partition_overflow[p_id] ? stripe_pref[p_id % stripe_pref.size()] : spill_tier_pref; }
+
+    // Returns the path-prefix of the collated files of the partition `p_id`:
+    // in the output directory it is striped onto, if any; otherwise, in place
+    // of its deposits.
+    const std::string& collated_pref(const std::size_t p_id) const
+    { return output_pref.empty() ? partition_pref(p_id) : output_pref[p_id % output_pref.size()]; }
+
+    // Returns the work directory index of the partition of the spill stream
+    // `s_id`.
+    std::size_t stream_stripe(const std::size_t s_id) const
+    { return (s_id < partition_count ? s_id : (s_id - partition_count) / split_fanout) % stripe_pref.size(); }
+
+    // Returns the disk-file path for the collated partition `p_id`.
     const std::string partition_file_path(std::size_t p_id) const;
 
+    // Returns the disk-file path the deposits to the partition `p_id` are
+    // spilled into, unless incremental; the same as the collated partition's,
+    // unless collated into a separate output directory.
+    const std::string spill_file_path(std::size_t p_id) const;
+
+    // Returns the disk-file path for the run of deposits to be merged into the
+    // partition `p_id`.
+    const std::string run_file_path(std::size_t p_id) const;
+
+    // Returns the disk-file path the deposits to the partition `p_id` are
+    // spilled into.
+    const std::string deposit_file_path(const std::size_t p_id) const { return incremental ? run_file_path(p_id) : spill_file_path(p_id); }
+
+    // Returns the path of the file in the fast spill tier holding the
+    // deposits to the partition `p_id` before it overflowed the tier.
+    const std::string fast_file_path(std::size_t p_id) const;
+
+    // Returns the disk-file paths holding the deposits to the partition
+    // `p_id`, apart from the child runs of a split: the ones in the fast
+    // spill tier before an overflow, if any; the ones received from the
+    // other processes of an exchange, if any; and the deposit file.
+    std::vector<std::string> deposit_file_paths(std::size_t p_id) const;
+
+    // Returns the disk-file path for the pairs of the partition `p_id`
+    // received from the process with rank `rank` in the exchange.
+    const std::string exchange_file_path(std::size_t p_id, std::size_t rank) const;
+
+    // Returns the disk-file path for the child run `c_id` of the split
+    // partition `p_id`.
+    const std::string split_file_path(std::size_t p_id, std::size_t c_id) const;
+
+    // Returns the disk-file path the last buffers of the partitions in the
+    // work directory `stripe` are flushed into at the close of the deposit
+    // stream.
+    const std::string tail_file_path(const std::size_t stripe) const { return stripe_pref[stripe] + tail_file_ext; }
+
+    // Returns the disk-file path the collated partition `p_id` is persisted
+    // at for the manifest with ID `manifest_id`: beside the partition file,
+    // but apart from the names of the working files, so that no collator at
+    // the same path-prefix removes it.
+    const std::string dataset_file_path(std::size_t p_id, const std::string& manifest_id) const;
+
+    // Returns the ID of the spill stream for the child run `c_id` of the
+    // partition `p_id`. The child runs are always in the work directories.
+    static std::size_t split_stream_id(const std::size_t p_id, const std::size_t c_id) { return partition_count + p_id * split_fanout + c_id; }
+
+    // Returns the disk-file path the spill stream `s_id` is written into.
+    const std::string stream_file_path(const std::size_t s_id) const
+    { return s_id < partition_count ? deposit_file_path(s_id) : split_file_path((s_id - partition_count) / split_fanout, (s_id - partition_count) % split_fanout); }
+
+    // Returns the disk-file path for the array with extension `ext` of the
+    // grouped partition `p_id`.
+    const std::string grouped_file_path(std::size_t p_id, const char* ext) const;
+
+    // Returns the path to the checkpoint file.
+    const std::string checkpoint_file_path() const;
+
+    // Returns the size of the file at path `file_path` in bytes.
+    static off_t file_size(const std::string& file_path);
+
+    // Flushes the file (or directory) at path `file_path` to the storage device.
+    static void sync_file(const std::string& file_path);
+
+    // Flushes the directory containing the file at path `file_path` to the
+    // storage device, making the creation and renaming of the file durable.
+    static void sync_parent_dir(const std::string& file_path);
+
+    // Starts the write-back of the dirty pages of the file with descriptor
+    // `fd` in the `bytes` bytes from the byte-offset `offset`, and drops its
+    // pages written back from the page cache, iff the policy is to drop them.
+    // The `bytes` 0 extend the range to the end of the file.
+    void drop_pages(int fd, off_t offset = 0, off_t bytes = 0) const;
+
+    // Drops the pages of the file at path `file_path` as above.
+    void drop_pages(const std::string& file_path) const;
+
+    // Sets the I/O scheduling class and priority level of the calling thread
+    // to the ones encoded in `ioprio`; the class none returns the thread to
+    // the default one. Returns `false` iff the thread is not permitted them.
+    static bool apply_io_priority(int ioprio);
+
+    // Returns `true` iff the partition `p_id` has been collated as per the
+    // checkpoint.
+    bool partition_collated(const std::size_t p_id) const { return checkpoint_fd >= 0 && checkpoint_entry[p_id].collated; }
+
+    // Returns the number of pairs deposited to the partition `p_id`.
+    std::size_t partition_pair_count(std::size_t p_id) const;
+
+    // Returns the memory required to collate the partition `p_id`, in bytes.
+    off_t partition_collate_bytes(std::size_t p_id) const;
+
+    // Returns the size of the runs the split partition `p_id` is sorted in,
+    // in bytes: enough for its largest child run, and for its pairs
+    // deposited before the split up to the split threshold, so that these
+    // are usually sorted in a single run, merged from memory.
+    off_t split_run_bytes(std::size_t p_id) const;
+
+    // Takes the first checkpoint of the collation, with the partitions as
+    // deposited.
+    void create_checkpoint();
+
+    // Loads the checkpoint of an interrupted collation to resume it.
+    void load_checkpoint();
+
+    // Writes the checkpoint header durably, after validating the collation
+    // with the output format `format` and aggregation flag `aggregate`
+    // against the one checkpointed, if any.
+    void checkpoint_collation(Output_Format format, bool aggregate);
+
+    // Writes the checkpoint entry of the partition `p_id` durably, with its
+    // pair-count `pair_count` and aggregate statistics `result`.
+    void checkpoint_partition(std::size_t p_id, std::size_t pair_count, const Aggregate_Result& result);
+
+    // Writes `bytes` bytes from `buf` to the file with descriptor `fd` at the
+    // byte-offset `offset`.
+    static void write_at(int fd, const void* buf, std::size_t bytes, off_t offset);
+
+    // Writes the `iov_count` buffers of `iov` to the file with descriptor `fd`
+    // at its current offset, with as few system calls as possible; `iov` is
+    // consumed in the process.
+    static void write_vec(int fd, iovec* iov, std::size_t iov_count);
+
+    // Reads `bytes` bytes into `buf` from the file with descriptor `fd` at the
+    // byte-offset `offset`.
+    static void read_at(int fd, void* buf, std::size_t bytes, off_t offset);
+
+    // Returns the layout of the partitions with pair-counts `p_pair_count`,
+    // as stored by the collation.
+    std::shared_ptr<const Collation_Layout> make_layout(const std::vector<std::size_t>& p_pair_count, bool deposited = false) const;
+
+    // Returns the on-disk header for the collation, with a path table of
+    // `path_table_size` bytes.
+    Collation_File_Header make_header(std::size_t path_table_size) const;
+
+    // Returns a free partition buffer, carving a new slab if required.
+    key_val_pair_t* acquire_partition_buf();
+
+    // Returns the partition buffer `p_buf` to the free ones, once spilled.
+    void return_partition_buf(key_val_pair_t* p_buf);
+
+    // Maps the window of the file of the spill stream `s_id` following its
+    // spilled bytes, in the mapped spill mode, and returns it as the stream's
+    // buffer. Opens the file at the first window, and reopens it at its path
+    // once its partition overflows the fast spill tier.
+    key_val_pair_t* map_window(std::size_t s_id);
+
+    // Unmaps the window of the spill stream `s_id`, filled up to its buffer
+    // size, in the mapped spill mode; trims the file to the pairs in it.
+    void unmap_window(std::size_t s_id);
+
+    // Flushes the partially filled buffers of the partitions at the close of
+    // the deposit stream into the tail files of their work directories, with
+    // a single vectored write per directory rather than one per partition.
+    // The buffers of the streams spilled on their own stay: the ones of split
+    // partitions, of partitions in the fast spill tier, of the mapped mode,
+    // and of checkpointed collations, whose deposits are made durable in
+    // their own files.
+    void flush_tails();
+
+    // Returns the buffers of all the partitions to the slabs, and releases
+    // the slabs' memory while keeping them for reuse.
+    void release_partition_bufs();
+
+    // Returns the paths to the working files: the files of the partitions,
+    // unless moved into a single file, and the checkpoint file.
+    // Some of these may have never been created.
+    std::vector<std::string> work_file_paths() const;
+
+    // Closes the checkpoint file, if open.
+    void close_checkpoint();
+
+    // Removes the working files.
+    void remove_work_files();
+
     // Maps the key-value pairs from the producers to the partitions
     // corresponding to the keys.
     void map();
 
-    // Maps the key-value pairs from the data buffer `buf` to the partitions
+    // Maps the `count` key-value pairs at `pairs` to the partitions
     // corresponding to the keys.
-    void map_buffer(const buf_t& buf);
+    void map_buffer(const key_val_pair_t* pairs, std::size_t count);
 
     // Returns the corresponding partition ID for the key `key`.
     std::size_t get_partition_id(const T_key_& key) const;
 
-    // Flushes the buffer of the partition with ID `p_id` to disk and
-    // clears the buffer.
-    void flush(std::size_t p_id);
+    // Returns the corresponding child run ID for the key `key` in its split
+    // partition: from the hash bits next to the ones of the partition ID.
+    std::size_t get_split_id(const T_key_& key) const;
+
+    // Hands the buffer of the spill stream with ID `s_id` to the spill writer
+    // of its work directory, to be written to disk, or unmaps it in the
+    // mapped spill mode, and clears the buffer. Splits the partition once its
+    // run grows too large.
+    void flush(std::size_t s_id);
+
+    // Sends the pairs pending for the process with rank `rank` of the
+    // exchange to it.
+    void send_exchange_buf(std::size_t rank);
+
+    // Receives the pairs of the partitions of this process from the process
+    // with rank `rank` through the socket `fd`, into files of their own,
+    // until the process closes its deposit stream.
+    void receive_exchange(int fd, std::size_t rank);
+
+    // Sends the rest of the pairs of the other processes of the exchange,
+    // and waits until all the pairs of this process's partitions are
+    // received from the others.
+    void close_exchange();
+
+    // Hands the buffer of the spill stream `s_id` to its spill writer, with
+    // the stream moved out of the fast spill tier if it is full.
+    void submit_spill(std::size_t s_id);
+
+    // Collates the partition with ID `p_id` using the memory at `p_data`, and
+    // writes it back in the output format. Aggregates its statistics into
+    // `result` iff `aggregate` is `true`. Returns the pair-count of the
+    // partition.
+    std::size_t collate_partition(std::size_t p_id, key_val_pair_t* p_data, bool aggregate, Aggregate_Result& result);
+
+    // Merges the `elem_count` sorted new pairs at `p_data` into the collated
+    // partition with ID `p_id`, and writes it back in the pairs format.
+    // Aggregates its statistics into `result` iff `aggregate` is `true`.
+    // Returns the pair-count of the merged partition.
+    std::size_t merge_partition(std::size_t p_id, const key_val_pair_t* p_data, std::size_t elem_count, bool aggregate, Aggregate_Result& result);
+
+    // Collates the split partition with ID `p_id` like `collate_partition`:
+    // sorts each child run independently using the memory at `p_data`, and
+    // the pairs deposited before the split in runs of that memory, keeping
+    // the last of these in it; then merges all the sorted runs into the
+    // partition.
+    std::size_t collate_split_partition(std::size_t p_id, key_val_pair_t* p_data, bool aggregate, Aggregate_Result& result);
+
+    // Completes the collation of the split partition `p_id` once it is
+    // checkpointed: moves the collated partition into place iff `in_place`,
+    // i.e. it is collated into its partition file, and removes the runs it
+    // was collated from.
+    void finish_split_partition(std::size_t p_id, bool in_place);
+
+    class Partition_Writer;
 
 
 public:
@@ -102,13 +512,142 @@ public:
     // `work_file_pref`. `buf_count` concurrent buffers would be used to store
     // and process the deposited data. It should be set to at least the number
     // of producers to avoid throttling of the producers; and a good heuristic
-    // choice for this is twice the number of producers.
-    Key_Value_Collator(const std::string& work_file_pref = work_file_pref_default, std::size_t buf_count = buf_count_default);
+    // choice for this is twice the number of producers. With the checkpoint
+    // mode `checkpoint_mode` set to `on`, the collation can be resumed after an
+    // interruption by a collator constructed at the same path-prefix with the
+    // mode `resume`, and invoking the same collation operation again.
+    Key_Value_Collator(const std::string& work_file_pref = work_file_pref_default, std::size_t buf_count = buf_count_default, Checkpoint_Mode checkpoint_mode = Checkpoint_Mode::off);
+
+    // Constructs a key-value pair collection object like above, with the
+    // partitions striped across the path-prefixes `work_file_prefs`, e.g.
+    // one in each of several storage devices: the partition `i` is stored
+    // at `work_file_prefs[i % work_file_prefs.size()]`. The spills into each
+    // of these are written by a thread of its own, and the collation keeps
+    // each of these busy. The checkpoint is at the first path-prefix, and a
+    // resuming collator must be constructed with the same path-prefixes.
+    Key_Value_Collator(const std::vector<std::string>& work_file_prefs, std::size_t buf_count = buf_count_default, Checkpoint_Mode checkpoint_mode = Checkpoint_Mode::off);
 
     ~Key_Value_Collator();
 
-    class Aggregate_Result;
-    mutable Aggregate_Result agg_result;
+    Aggregate_Result agg_result;
+
+    // Sets the size of the deposits to a partition, in bytes, after which its
+    // later pairs are split into 8 child runs by more bits of the key hashes,
+    // so that a partition grown large with skewed keys is sorted in pieces.
+    // Collating a split partition takes memory for the larger of its largest
+    // child run and the threshold, rather than for the whole partition. The
+    // size 0 disables the splits. Must be set before the deposits.
+    void set_partition_split_threshold(const std::size_t bytes) { partition_split_th = bytes; }
+
+    // Residency of the spilled deposits across the spill tiers.
+    struct Spill_Residency
+    {
+        std::size_t fast_bytes; // Number of bytes spilled into the fast tier.
+        std::size_t disk_bytes; // Number of bytes spilled into the work directories.
+        std::size_t fast_partition_count;   // Number of partitions spilled wholly into the fast tier.
+        std::size_t disk_partition_count;   // Number of partitions spilled into the work directories, wholly or after an overflow.
+    };
+
+    // Adds a fast spill tier in front of the work directories: a path-prefix
+    // `fast_pref`, e.g. on a tmpfs, with the capacity `capacity` in bytes.
+    // The partitions are spilled into the tier first; once it is full, the
+    // later deposits of the partitions spilling then overflow into their
+    // work directories, while the partitions that have filled the tier stay
+    // in it, collated in place. Must be set before the deposits; not usable
+    // with checkpointing, as the tier does not outlive the machine.
+    void set_spill_tier(const std::string& fast_pref, std::size_t capacity);
+
+    // Returns the residency of the deposits across the spill tiers, as of
+    // the closing of the deposit stream.
+    Spill_Residency spill_residency() const;
+
+    // Sets the cap on the memory of the partitions being collated at once, in
+    // bytes: the collator threads take up partitions only while their sizes
+    // sum within the cap, so that the peak memory of the collation is bounded
+    // independent of the thread-count. A partition larger than the cap is
+    // collated alone. The cap 0 (default) leaves the memory unbounded.
+    void set_collate_memory_cap(const std::size_t bytes) { collate_mem_cap = bytes; }
+
+    // Sets the policy on the page cache for the spilled and the collated
+    // files to `policy`; `Page_Cache_Policy::keep` by default. It applies to
+    // the iterators over the collation taken afterwards.
+    void set_page_cache_policy(const Page_Cache_Policy policy) { page_cache_policy = policy; }
+
+    // Sets the mode of spilling the partition buffers to `mode`;
+    // `Spill_Mode::written` by default. The mapped mode saves the copy of
+    // each spilled pair into the page cache, but a full disk then faults the
+    // mapper with `SIGBUS` rather than failing a write. Must be set before the
+    // deposits.
+    void set_spill_mode(const Spill_Mode mode) { spill_mode = mode; }
+
+    // Limits the bandwidth of the reads of the collation to `read_bytes_per_sec`
+    // bytes per second, and of the spills and the writes of the collation to
+    // `write_bytes_per_sec`; the limit 0 (default) leaves the bandwidth
+    // unlimited. The limits are enforced with token buckets shared by all
+    // the threads of the collator.
+    void set_io_rate_limits(std::size_t read_bytes_per_sec, std::size_t write_bytes_per_sec);
+
+    // Sets the I/O scheduling class of the spill writers and the collation
+    // threads to `io_class`, at the priority level `level` in [0, 7], 0 being
+    // the highest; takes effect for the threads' I/O from the next spills and
+    // collation on, so it may be invoked during the deposits. The level is
+    // ignored for `IO_Priority_Class::none`. Returns `false`, leaving the
+    // priority as it was, iff the process is not permitted the class, e.g.
+    // `IO_Priority_Class::realtime` without the `CAP_SYS_ADMIN` capability.
+    bool set_io_priority(IO_Priority_Class io_class, int level = 4);
+
+    // Returns the I/O statistics of the collator, with the time the I/O has
+    // been held back by the rate limits, to size the limits against.
+    IO_Stats io_stats() const;
+
+    // Sets the path-prefixes `output_file_prefs` of the collated partitions,
+    // one per output directory, striped over like the work directories; by
+    // default, the partitions are collated in place of their deposits. With
+    // the output on devices apart from the deposits, the collation reads and
+    // writes the partitions on separate devices. Must be set before the
+    // collation, also when resuming one.
+    void set_output_file_prefs(const std::vector<std::string>& output_file_prefs);
+
+    // Spreads the collation over `process_count` processes, of which this
+    // one has the rank `rank`, like a shuffle: each process owns a range of
+    // the partitions, and its mapper routes the pairs of the other ranges to
+    // their owners over Unix sockets at the path-prefix `exchange_pref`,
+    // e.g. in a directory shared by the processes' containers. Each process
+    // then collates only its own partitions; the pairs of the others are
+    // collated by their owners. All the processes are to invoke this before
+    // the deposits, with distinct ranks, and it waits until they all have;
+    // it aborts if they have not within a minute. Closing the deposit
+    // stream waits for the deposit streams of all the processes to close.
+    // Lasts until a reset; not usable with checkpointing or reopened
+    // deposit streams.
+    void set_partition_exchange(const std::string& exchange_pref, std::size_t process_count, std::size_t rank);
+
+    // Returns the rank of the process owning the partition `p_id` in the
+    // exchange; 0 unless the collation is spread over processes.
+    std::size_t partition_owner(const std::size_t p_id) const { return p_id * exchange_count / partition_count; }
+
+    // Reopens the deposit stream after a collation in the pairs format, to
+    // deposit more pairs into the collection. The new pairs are spilled apart
+    // from the collated partitions, which stay readable until the next
+    // collation; that collation sorts only the new pairs, and merges them
+    // into the collated partitions. Not usable with persisted or
+    // checkpointed collations.
+    void reopen_deposit_stream();
+
+    // Readies the collator to receive deposits for another round of
+    // collation: the previous collation and its files are discarded, along
+    // with the splits and the tier overflows of its partitions, and the
+    // partition exchange. The producer-buffers are retained, and so are the
+    // settings: the split threshold, the collate memory cap, the page-cache
+    // policy, the spill mode, the spill tier, the I/O rate limits and
+    // priority, the output directories, and the checkpoint mode; the I/O
+    // statistics keep accumulating. The deposit stream must be closed before
+    // invoking this, and the collation must not have been persisted.
+    void reset();
+
+    // Returns `true` iff a checkpoint of an interrupted collation exists for
+    // the working-file path-prefix `work_file_pref`, so that it can be resumed.
+    static bool checkpoint_exists(const std::string& work_file_pref = work_file_pref_default);
 
     // Returns an available free buffer.
     buf_t& get_buffer();
@@ -116,6 +655,18 @@ public:
     // Returns the buffer `buf` to the collator with deposited data.
     void return_buffer(buf_t& buf);
 
+    // Opens a channel for producers in other processes to deposit through,
+    // without copying: a `Shared_Buffer_Pool` of `buf_count` buffers of
+    // `buf_capacity` pairs each, in a shared-memory region at the path
+    // `channel_path`, e.g. on `/dev/shm`. The producers attach to the pool at
+    // the path, and the mapper maps their full buffers in place, along with
+    // the buffers of this process. The channel lasts for the current deposit
+    // stream: closing the stream waits for all the buffers of the channel to
+    // be returned, and removes the region. The wait aborts if a producer
+    // exits holding a buffer, or if the buffers are not all returned within
+    // `shared_channel_timeout_sec` seconds.
+    void open_shared_deposit_channel(const std::string& channel_path, std::size_t buf_count = buf_count_default, std::size_t buf_capacity = shared_buf_capacity_default);
+
     // Closes the deposit stream incoming from the producers and flushes the
     // remaining in-memory content to disk. All deposit operations from the
     // producers must be made before invoking this.
@@ -123,8 +674,33 @@ public:
 
     // Collates the deposited key-value pairs, using at most `thread_count`
     // processor-threads. Also generates an aggregate result of the keys
-    // iff `aggregate = true`.
-    void collate(uint32_t thread_count, bool aggregate = false) const;
+    // iff `aggregate = true`. The collated partitions are written in the
+    // format `format`; the iterators and readers of the collation are only
+    // usable with the `pairs` format, and `grouped_partition_t` with the
+    // `grouped` one.
+    void collate(uint32_t thread_count, bool aggregate = false, Output_Format format = Output_Format::pairs);
+
+    // Collates the deposited key-value pairs like `collate`, in the pairs
+    // format, and writes the collation into a single file at `file_path`
+    // instead of a file per partition. The file has a header, a partition
+    // directory, and the partitions at page-aligned offsets; see
+    // `Collation_File_Header`. Each partition is written directly at its
+    // offset, precomputed from the deposited data. The file is not removed
+    // with the collator.
+    void collate_to_file(const std::string& file_path, uint32_t thread_count, bool aggregate = false);
+
+    // Persists the collation: writes a manifest of it to `manifest_path`, and
+    // links the collated partition files to names apart from the working
+    // files, `<prefix>.<partition>.<manifest ID>.dataset`, which outlive the
+    // collator and are not removed by the later collators at the same path-
+    // prefix. Persisting to the same manifest path again replaces the files.
+    // The collation can then be reopened with `Key_Value_Dataset`, without
+    // collating again. Only usable with collations in the pairs format.
+    void persist(const std::string& manifest_path);
+
+    // Returns the on-disk layout of the collation, for its readers. It is null
+    // unless the pairs have been collated in the pairs format.
+    std::shared_ptr<const Collation_Layout> collation_layout() const { return layout; }
 
     // Returns an iterator pointing at the beginning of the collection.
     iter_t begin() const;
@@ -132,6 +708,14 @@ public:
     // Returns an iterator pointing at the end of the collection.
     iter_t end() const;
 
+    // Returns an iterator pointing at the beginning of the collection, that
+    // iterates over the key-blocks in the global sorted order of the keys.
+    ordered_iter_t ordered_begin() const { return ordered_iter_t(*this); }
+
+    // Returns an iterator pointing at the end of the collection, for sorted-
+    // order iteration.
+    ordered_iter_t ordered_end() const { return ordered_iter_t(*this, true); }
+
     std::size_t unique_key_count() const { return agg_result.unique_key_count; }    // Returns the number of unique keys.
     std::size_t pair_count() const { return agg_result.pair_count; }    // Returns the total number of key-value pairs.
     std::size_t mode_frequency() const { return agg_result.mode_count; }    // Returns the number of pairs with a most frequent key.
@@ -250,308 +834,2616 @@ public:
 };
 
 
-template <typename T_key_, typename T_val_, typename T_hasher_>
-inline Key_Value_Collator<T_key_, T_val_, T_hasher_>::Key_Value_Collator(const std::string& work_file_pref, const std::size_t buf_count):
-    hash(),
-    work_file_pref(work_file_pref),
-    partition_buf(partition_count),
-    partition_file(partition_count),
-    buf_count(buf_count),
-    mapper(nullptr),
-    stream_incoming(true)
+// A remover of working files in the background, shared by the collators of a
+// process, so that the collators are destructed without waiting on the file
+// system. Pending removals are completed before the process exits. A process
+// forked off gets a remover of its own, and leaves the pending removals of the
+// parent to it.
+class Work_File_Remover
 {
-    static_assert(partition_buf_elem_th > 0, "Invalid configuration for partition buffer memory.");
+private:
 
-    for(std::size_t p_id = 0; p_id < partition_count; ++p_id)
-    {
-        partition_buf[p_id].reserve(partition_buf_elem_th);
-        partition_file[p_id].open(partition_file_path(p_id), std::ios::out | std::ios::binary);
-    }
+    std::deque<std::pair<std::string, std::vector<std::string>>> job;   // Pending removals: the path-prefix of a collator and its file paths.
+    std::size_t active; // Number of removals taken from the queue and not completed yet.
+    std::string active_pref;    // Path-prefix of the removal in progress.
+    bool stop;  // Whether the remover is to exit once the queue is drained.
 
-    for(std::size_t i = 0; i < buf_count; ++i)
-        buf_pool.add_buf(new buf_t());
+    std::mutex mtx; // Mutex for the removal queue; the remover thread sleeps on it while idle.
+    std::condition_variable cv; // Notifies the arrival of removals and the completion of them.
+    std::thread worker; // The background thread removing the files.
 
-    mapper = new std::thread(&Key_Value_Collator<T_key_, T_val_, T_hasher_>::map, this);
-}
+    friend struct std::default_delete<Work_File_Remover>;
 
 
-template <typename T_key_, typename T_val_, typename T_hasher_>
-inline Key_Value_Collator<T_key_, T_val_, T_hasher_>::~Key_Value_Collator()
-{
-    if(buf_pool.full_buf_count() > 0 || buf_pool.free_buf_count() != buf_count || mapper->joinable())
+    Work_File_Remover(): active(0), stop(false), worker(&Work_File_Remover::run, this)
+    {}
+
+    // Returns the owner of the remover of the process, which completes the
+    // pending removals at the exit of the process. The remover is created at
+    // the first call, and replaced in a forked child process.
+    static std::unique_ptr<Work_File_Remover>& current()
     {
-        std::cerr << "Collator destructed while unprocessed buffers remained. Aborting.\n";
-        std::exit(EXIT_FAILURE);
-    }
+        static std::unique_ptr<Work_File_Remover> remover(
+            []
+            {
+                pthread_atfork(
+                    []{ instance().mtx.lock(); },
+                    []{ instance().mtx.unlock(); },
+                    []{ restart(); });
 
+                return new Work_File_Remover();
+            }());
 
-    // Release memory of the partition-buffers.
-    buf_t* buf_p = nullptr;
-    while(buf_pool.free_buf_count() > 0)
-    {
-        buf_pool.fetch_free_buf(buf_p);
-        delete buf_p;
+        return remover;
     }
 
-    delete mapper;
-
+    // Replaces the remover in a forked child process, which has none of the
+    // threads of the parent, with the queue locked at the fork.
+    static void restart()
+    {
+        // The parent's remover is leaked rather than destructed: its mutex is locked, the parent's threads may have
+        // been waiting on its condition variable, and its thread object refers to no thread here.
+        current().release();
+        current().reset(new Work_File_Remover());
+    }
 
-    // Remove the partition-files.
-    for(std::size_t p_id = 0; p_id < partition_count; ++p_id)
-        if(std::remove(partition_file_path(p_id).c_str()))
+    ~Work_File_Remover()
+    {
         {
-            std::cerr << "Error removing temporary files. Aborting.\n";
-            std::exit(EXIT_FAILURE);
+            std::lock_guard<std::mutex> guard(mtx);
+            stop = true;
         }
-}
 
+        cv.notify_all();
+        worker.join();
+    }
 
-template <typename T_key_, typename T_val_, typename T_hasher_>
-inline typename Key_Value_Collator<T_key_, T_val_, T_hasher_>::buf_t& Key_Value_Collator<T_key_, T_val_, T_hasher_>::get_buffer()
-{
-    buf_t* buf_p;
-    while(!buf_pool.fetch_free_buf(buf_p));
+    // Removes the files of the queued removals, until stopped.
+    void run()
+    {
+        std::unique_lock<std::mutex> guard(mtx);
+        while(true)
+        {
+            cv.wait(guard, [this]{ return stop || !job.empty(); });
+            if(job.empty())
+                return;
 
-    return *buf_p;
-}
+            auto j = std::move(job.front());
+            job.pop_front();
+            active++;
+            active_pref = j.first;
 
+            guard.unlock();
+            remove_files(j.second);
+            guard.lock();
 
-template <typename T_key_, typename T_val_, typename T_hasher_>
-inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::return_buffer(buf_t& buf)
-{
-    buf_pool.return_full_buffer(&buf);
-}
+            active--;
+            cv.notify_all();
+        }
+    }
 
 
-template <typename T_key_, typename T_val_, typename T_hasher_>
-inline const std::string Key_Value_Collator<T_key_, T_val_, T_hasher_>::partition_file_path(const std::size_t p_id) const
-{
-    return work_file_pref + "." + std::to_string(p_id) + partition_file_ext;
-}
+public:
 
+    Work_File_Remover(const Work_File_Remover&) = delete;
+    Work_File_Remover& operator=(const Work_File_Remover&) = delete;
 
-template <typename T_key_, typename T_val_, typename T_hasher_>
-inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::map()
-{
-    buf_t* buf_p;
+    // Returns the remover of the process.
+    static Work_File_Remover& instance() { return *current(); }
 
-    while(stream_incoming || buf_pool.full_buf_count() > 0)
-        if(buf_pool.fetch_full_buf(buf_p))
-        {
-            map_buffer(*buf_p);
+    // Removes the files at paths `path`, skipping the ones that do not exist.
+    static void remove_files(const std::vector<std::string>& path)
+    {
+        for(const auto& p : path)
+            if(std::remove(p.c_str()) != 0 && errno != ENOENT)
+            {
+                std::cerr << "Error removing temporary files. Aborting.\n";
+                std::exit(EXIT_FAILURE);
+            }
+    }
 
-            buf_p->clear();
-            buf_pool.return_free_buf(buf_p);
+    // Queues the files at paths `path`, of a collator with the path-prefix
+    // `pref`, to be removed in the background.
+    void submit(const std::string& pref, std::vector<std::string>&& path)
+    {
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            job.emplace_back(pref, std::move(path));
         }
-}
 
+        cv.notify_all();
+    }
 
-template <typename T_key_, typename T_val_, typename T_hasher_>
-inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::map_buffer(const std::vector<Key_Value_Collator::key_val_pair_t>& buf)
-{
-    for(const auto& key_val_pair : buf)
+    // Waits till no removal for a collator with the path-prefix `pref` is
+    // pending.
+    void wait(const std::string& pref)
     {
-        const std::size_t p_id = get_partition_id(key_val_pair.first);
-        auto& p_buf = partition_buf[p_id];
-        p_buf.emplace_back(key_val_pair);
+        std::unique_lock<std::mutex> guard(mtx);
+        cv.wait(guard, [this, &pref]
+            {
+                if(active > 0 && active_pref == pref)
+                    return false;
+
+                for(const auto& j : job)
+                    if(j.first == pref)
+                        return false;
 
-        assert(p_buf.size() <= partition_buf_elem_th);
-        if(p_buf.size() == partition_buf_elem_th)
-            flush(p_id);
+                return true;
+            });
     }
-}
+};
 
 
-template <typename T_key_, typename T_val_, typename T_hasher_>
-inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::flush(const std::size_t p_id)
+// A scheduler of the partitions to be collated by the collator threads. The
+// largest partitions are handed out first, and a partition is admitted only
+// while the memory of the partitions in flight stays within a cap; smaller
+// partitions fill the rest of the cap. A partition larger than the cap is
+// admitted once nothing else is in flight. With the partitions striped across
+// storage devices, the ones on the devices with the fewest partitions in
+// flight are preferred, to keep all the devices busy.
+class Collate_Scheduler
 {
-    auto& buf  = partition_buf[p_id];
-    auto& file = partition_file[p_id];
-    if(!file.write(reinterpret_cast<const char*>(buf.data()), buf.size() * sizeof(key_val_pair_t)))
+private:
+
+    std::vector<std::pair<std::size_t, std::size_t>> pending;   // Partitions yet to be collated: their memory in bytes and IDs, in descending order.
+    const std::size_t mem_cap;  // Cap on the memory of the partitions in flight, in bytes; 0 if uncapped.
+    std::size_t in_flight_bytes;    // Memory of the partitions in flight.
+    std::size_t in_flight_count;    // Number of partitions in flight.
+    std::vector<std::size_t> device_in_flight;  // `device_in_flight[i]` is the number of partitions in flight on device `i`.
+
+    std::mutex mtx; // Mutex for the scheduling state.
+    std::condition_variable cv; // Notifies the release of memory.
+
+
+public:
+
+    // Constructs a scheduler of the partitions `partition`, each with the
+    // memory it requires in bytes and its ID, and the memory cap `mem_cap`.
+    // The partition with ID `i` is on the device `i % device_count`.
+    Collate_Scheduler(std::vector<std::pair<std::size_t, std::size_t>>&& partition, const std::size_t mem_cap, const std::size_t device_count = 1):
+        pending(std::move(partition)), mem_cap(mem_cap), in_flight_bytes(0), in_flight_count(0), device_in_flight(device_count, 0)
     {
-        std::cerr << "Error writing to partition file(s) of the collator. Aborting.\n";
-        std::exit(EXIT_FAILURE);
+        std::sort(pending.begin(), pending.end(), std::greater<std::pair<std::size_t, std::size_t>>());
     }
 
-    buf.clear();
-}
+    // Takes the next partition to collate: its ID into `p_id` and its memory
+    // into `bytes`, waiting until it can be admitted. Returns `false` iff no
+    // partitions are left.
+    bool acquire(std::size_t& p_id, std::size_t& bytes)
+    {
+        std::unique_lock<std::mutex> guard(mtx);
+        while(true)
+        {
+            if(pending.empty())
+                return false;
+
+            const std::size_t device_count = device_in_flight.size();
+            auto it = pending.end();
+            for(auto cand = pending.begin(); cand != pending.end(); ++cand)
+                if((mem_cap == 0 || in_flight_count == 0 || in_flight_bytes + cand->first <= mem_cap) &&
+                   (it == pending.end() || device_in_flight[cand->second % device_count] < device_in_flight[it->second % device_count]))
+                    it = cand;
+
+            if(it != pending.end())
+            {
+                bytes = it->first;
+                p_id = it->second;
+                pending.erase(it);
+                in_flight_bytes += bytes;
+                in_flight_count++;
+                device_in_flight[p_id % device_count]++;
+                return true;
+            }
+
+            cv.wait(guard);
+        }
+    }
+
+    // Releases the partition `p_id`, collated with `bytes` bytes of memory.
+    void release(const std::size_t p_id, const std::size_t bytes)
+    {
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            in_flight_bytes -= bytes;
+            in_flight_count--;
+            device_in_flight[p_id % device_in_flight.size()]--;
+        }
+
+        cv.notify_all();
+    }
+};
 
 
 template <typename T_key_, typename T_val_, typename T_hasher_>
-inline std::size_t Key_Value_Collator<T_key_, T_val_, T_hasher_>::get_partition_id(const T_key_& key) const
-{
-    return hash(key) & (partition_count - 1);
-}
+inline Key_Value_Collator<T_key_, T_val_, T_hasher_>::Key_Value_Collator(const std::string& work_file_pref, const std::size_t buf_count, const Checkpoint_Mode checkpoint_mode):
+    Key_Value_Collator(std::vector<std::string>(1, work_file_pref), buf_count, checkpoint_mode)
+{}
 
 
 template <typename T_key_, typename T_val_, typename T_hasher_>
-inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::close_deposit_stream()
+inline Key_Value_Collator<T_key_, T_val_, T_hasher_>::Key_Value_Collator(const std::vector<std::string>& work_file_prefs, const std::size_t buf_count, const Checkpoint_Mode checkpoint_mode):
+    hash(),
+    work_file_pref(work_file_prefs.empty() ? std::string() : work_file_prefs.front()),
+    stripe_pref(work_file_prefs),
+    partition_buf(stream_count, nullptr),
+    partition_buf_size(stream_count, 0),
+    partition_fd(stream_count, -1),
+    spill_mode(Spill_Mode::written),
+    stream_file_size(stream_count, 0),
+    partition_split_th(partition_split_th_default),
+    partition_spill_bytes(partition_count, 0),
+    partition_split(partition_count, 0),
+    tail_count(partition_count, 0),
+    tail_offset(partition_count, 0),
+    collate_mem_cap(0),
+    page_cache_policy(Page_Cache_Policy::keep),
+    io_prio(static_cast<int>(IO_Priority_Class::none) << io_prio_class_shift),
+    spill_tier_cap(0),
+    fast_spill_bytes(0),
+    disk_spill_bytes(0),
+    partition_overflow(partition_count, 0),
+    exchange_count(1),
+    exchange_rank(0),
+    buf_count(buf_count),
+    shared_pool(nullptr),
+    mapper(nullptr),
+    stream_incoming(true),
+    output_fd(-1),
+    aggregated(false),
+    persisted(false),
+    incremental(false),
+    checkpointing(checkpoint_mode != Checkpoint_Mode::off),
+    checkpoint_fd(-1),
+    output_format(Output_Format::pairs)
 {
-    stream_incoming = false;
-    if(!mapper->joinable())
+    static_assert(partition_buf_elem_th > 0, "Invalid configuration for partition buffer memory.");
+
+    if(stripe_pref.empty())
     {
-        std::cerr << "Early termination encountered for the key-mapper thread. Aborting.\n";
+        std::cerr << "No path-prefix provided for the working files. Aborting.\n";
         std::exit(EXIT_FAILURE);
     }
 
-    mapper->join();
+    for(std::size_t i = 0; i < buf_count; ++i)
+        buf_pool.add_buf(new buf_t());
 
+    for(std::size_t i = 0; i < stripe_pref.size(); ++i)
+        spill_writer.emplace_back(new Spill_Writer(*this));
 
-    // Flush the remaining in-memory partition contents, release their memory, and close the in-disk partitions.
+    // Earlier collators at the path-prefix may still be removing their files in the background.
+    Work_File_Remover::instance().wait(work_file_pref);
+
+    if(checkpoint_mode == Checkpoint_Mode::resume)  // The partitions are already deposited.
+    {
+        stream_incoming = false;
+        load_checkpoint();
+        return;
+    }
+
+    // The partition files and the child runs of splits are created at their first flushes, so stale ones from
+    // earlier collations at the same path-prefix are removed, along with a stale checkpoint. Persisted collations are
+    // linked under names of their own, which are left alone.
+    std::vector<std::string> stale_path;
     for(std::size_t p_id = 0; p_id < partition_count; ++p_id)
     {
-        if(!partition_buf[p_id].empty())
-            flush(p_id);
+        stale_path.emplace_back(spill_file_path(p_id));
+        for(std::size_t c_id = 0; c_id < split_fanout; ++c_id)
+            stale_path.emplace_back(split_file_path(p_id, c_id));
+    }
 
-        buf_t().swap(partition_buf[p_id]);
+    stale_path.emplace_back(checkpoint_file_path());
+    Work_File_Remover::remove_files(stale_path);
 
-        partition_file[p_id].close();
-    }
+    mapper = new std::thread(&Key_Value_Collator<T_key_, T_val_, T_hasher_>::map, this);
 }
 
 
 template <typename T_key_, typename T_val_, typename T_hasher_>
-inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::collate(const uint32_t thread_count, const bool aggregate) const
+inline typename Key_Value_Collator<T_key_, T_val_, T_hasher_>::key_val_pair_t* Key_Value_Collator<T_key_, T_val_, T_hasher_>::acquire_partition_buf()
 {
-    std::vector<std::thread> worker;
-    std::vector<Aggregate_Result> worker_aggregate(thread_count, Aggregate_Result());
-    for(uint32_t t_id = 0; t_id < thread_count; ++t_id)
-        worker.emplace_back(
-            [this, aggregate](const uint32_t init_id, const uint32_t stride, Aggregate_Result& result)
-            // Collates each partition with IDs starting from `init_id` and at stride lengths `stride`.
-            {
-                Aggregate_Result result_local;  // To avoid possible false-sharing.
+    std::lock_guard<Spin_Lock> guard(partition_buf_lock);
+    if(free_partition_buf.empty())
+    {
+        const std::size_t slab_bytes = slab_buf_count * partition_buf_elem_th * sizeof(key_val_pair_t);
+        void* const mem = mmap(nullptr, slab_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(mem == MAP_FAILED)
+        {
+            std::cerr << "Error allocating memory for partition buffers. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
 
-                const auto file_size = [](const char* const file_name) -> off_t
-                    {
-                        struct stat st;
-                        return stat(file_name, &st) == 0 ? st.st_size : 0;
-                    };
+        slab.emplace_back(static_cast<key_val_pair_t*>(mem));
+        for(std::size_t i = slab_buf_count; i > 0; --i)
+            free_partition_buf.emplace_back(slab.back() + (i - 1) * partition_buf_elem_th);
+    }
 
-                // Get the maximum partition size for this thread.
-                off_t buf_sz = 0; // in bytes
-                for(uint32_t p_id = init_id; p_id < partition_count; p_id += stride)
-                    buf_sz = std::max(buf_sz, file_size(partition_file_path(p_id).c_str()));
+    key_val_pair_t* const p_buf = free_partition_buf.back();
+    free_partition_buf.pop_back();
 
-                key_val_pair_t* const p_data = static_cast<key_val_pair_t*>(std::malloc(buf_sz));
-                for(uint32_t p_id = init_id; p_id < partition_count; p_id += stride)
-                {
-                    // Read in the partition data to memory.
+    return p_buf;
+}
 
-                    const std::string p_path = partition_file_path(p_id);
-                    const auto p_bytes = file_size(p_path.c_str());
 
-                    std::ifstream input(p_path.c_str(), std::ios::in | std::ios::binary);
-                    if(!input.read(reinterpret_cast<char*>(p_data), p_bytes))
-                    {
-                        std::cerr << "Error reading the partition files. Aborting.\n";
-                        std::exit(EXIT_FAILURE);
-                    }
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::return_partition_buf(key_val_pair_t* const p_buf)
+{
+    std::lock_guard<Spin_Lock> guard(partition_buf_lock);
+    free_partition_buf.emplace_back(p_buf);
+}
+
 
-                    input.close();
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::flush_tails()
+{
+    if(spill_mode == Spill_Mode::mapped || checkpointing)
+        return;
 
+    // The partitions whose last buffers go to the tail files, by their work directories.
+    std::vector<std::vector<std::size_t>> tail_p_id(stripe_pref.size());
+    for(std::size_t p_id = 0; p_id < partition_count; ++p_id)
+    {
+        const std::size_t bytes = partition_buf_size[p_id] * sizeof(key_val_pair_t);
+        const bool tiered = (!spill_tier_pref.empty() && !partition_overflow[p_id] && !incremental);
+        const bool splits = (partition_split[p_id] || (partition_split_th > 0 && !incremental && partition_spill_bytes[p_id] + bytes >= partition_split_th));
+        if(bytes > 0 && !tiered && !splits)
+            tail_p_id[stream_stripe(p_id)].push_back(p_id);
+    }
 
-                    // Sort the partition data and optionally get aggregate statistics.
-                    const std::size_t elem_count = p_bytes / sizeof(key_val_pair_t);
-                    std::sort(p_data, p_data + elem_count);
+    // The directories are written in parallel, as they may be on different storage devices.
+    std::vector<std::thread> writer;
+    for(std::size_t i = 0; i < stripe_pref.size(); ++i)
+        if(!tail_p_id[i].empty())
+            writer.emplace_back(
+                [this, i, &tail_p_id]()
+                {
+                    apply_io_priority(io_prio);
 
-                    if(aggregate && elem_count > 0) // Aggregate results from this partition.
+                    std::vector<iovec> iov;
+                    off_t offset = 0;
+                    for(const std::size_t p_id : tail_p_id[i])
                     {
-                        T_key_ curr_key = p_data[0].first;
-                        std::size_t curr_key_freq = 1;
-                        result_local.unique_key_count++;
-
-                        if(result_local.mode_count < 1)
-                            result_local.mode_count = 1;
-
-                        for(std::size_t i = 1; i < elem_count; ++i)
-                            if(p_data[i].first != curr_key)
-                            {
-                                curr_key = p_data[i].first;
-                                curr_key_freq = 1;
-                                result_local.unique_key_count++;
-                            }
-                            else
-                                if(result_local.mode_count < ++curr_key_freq)
-                                    result_local.mode_count = curr_key_freq;
-
-                        result_local.pair_count += elem_count;
+                        tail_count[p_id] = partition_buf_size[p_id];
+                        tail_offset[p_id] = offset;
+                        iov.push_back(iovec{partition_buf[p_id], tail_count[p_id] * sizeof(key_val_pair_t)});
+                        offset += iov.back().iov_len;
                     }
 
-
-                    // Write the partition data back to disk.
-
-                    std::remove(p_path.c_str());    // Remove the file, as ext4 fs driver close() waits before data
-                                                    // are really written to the disk when done on an *existing* i-node.
-                                                    // https://superuser.com/questions/865710/write-to-newfile-vs-overwriting-performance-issue
-                    std::ofstream output(p_path.c_str(), std::ios::out | std::ios::binary);
-                    if(!output.write(reinterpret_cast<const char*>(p_data), p_bytes))
+                    const int fd = open(tail_file_path(i).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                    if(fd < 0)
                     {
-                        std::cerr << "Error writing to the partition files. Aborting.\n";
+                        std::cerr << "Error opening partition file(s) of the collator. Aborting.\n";
                         std::exit(EXIT_FAILURE);
                     }
 
-                    output.close();
+                    write_limiter.acquire(offset);
+                    write_vec(fd, iov.data(), iov.size());
+                    drop_pages(fd);
+                    if(close(fd) != 0)
+                    {
+                        std::cerr << "Error closing the partition files of the collator. Aborting.\n";
+                        std::exit(EXIT_FAILURE);
+                    }
                 }
+            );
 
-                std::free(p_data);
-
-                result = result_local;
-            },
-            t_id, thread_count, std::ref(worker_aggregate[t_id])
-        );
-
+    for(std::thread& w : writer)
+        w.join();
 
-    for(uint32_t t_id = 0; t_id < thread_count; ++t_id)
-    {
-        if(!worker[t_id].joinable())
+    for(const auto& p_ids : tail_p_id)
+        for(const std::size_t p_id : p_ids)
         {
-            std::cerr << "Early termination encountered for a collator thread. Aborting.\n";
-            std::exit(EXIT_FAILURE);
+            disk_spill_bytes += partition_buf_size[p_id] * sizeof(key_val_pair_t);
+            partition_buf_size[p_id] = 0;
         }
-
-        worker[t_id].join();
-        agg_result.aggregate(worker_aggregate[t_id]);
-    }
 }
 
 
 template <typename T_key_, typename T_val_, typename T_hasher_>
-inline Key_Value_Iterator<T_key_, T_val_> Key_Value_Collator<T_key_, T_val_, T_hasher_>::begin() const
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::release_partition_bufs()
 {
-    return iter_t(work_file_pref, partition_count);
+    for(std::size_t s_id = 0; s_id < stream_count; ++s_id)
+        if(partition_buf[s_id] != nullptr)
+        {
+            free_partition_buf.emplace_back(partition_buf[s_id]);
+            partition_buf[s_id] = nullptr;
+        }
+
+    // The pages are given back to the system for the collation, and are mapped afresh on the next use.
+    const std::size_t slab_bytes = slab_buf_count * partition_buf_elem_th * sizeof(key_val_pair_t);
+    for(key_val_pair_t* const s : slab)
+        madvise(s, slab_bytes, MADV_DONTNEED);
 }
 
 
 template <typename T_key_, typename T_val_, typename T_hasher_>
-inline Key_Value_Iterator<T_key_, T_val_> Key_Value_Collator<T_key_, T_val_, T_hasher_>::end() const
+inline Key_Value_Collator<T_key_, T_val_, T_hasher_>::~Key_Value_Collator()
 {
-    return iter_t(work_file_pref, partition_count, true);
-}
-
+    if(buf_pool.full_buf_count() > 0 || buf_pool.free_buf_count() != buf_count || (mapper != nullptr && mapper->joinable()))
+    {
+        std::cerr << "Collator destructed while unprocessed buffers remained. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
 
-template <typename T_key_, typename T_val_, typename T_hasher_>
-const char Key_Value_Collator<T_key_, T_val_, T_hasher_>::partition_file_ext[];
 
+    // Release memory of the partition-buffers.
+    buf_t* buf_p = nullptr;
+    while(buf_pool.free_buf_count() > 0)
+    {
+        buf_pool.fetch_free_buf(buf_p);
+        delete buf_p;
+    }
 
-// A class to pack aggregation results from `Key_Value_Collator`.
-template <typename T_key_, typename T_val_, typename T_hasher_>
-class Key_Value_Collator<T_key_, T_val_, T_hasher_>::Aggregate_Result
-{
-    friend class Key_Value_Collator<T_key_, T_val_, T_hasher_>;
+    delete mapper;
+    spill_writer.clear();
 
-private:
+    const std::size_t slab_bytes = slab_buf_count * partition_buf_elem_th * sizeof(key_val_pair_t);
+    for(key_val_pair_t* const s : slab)
+        munmap(s, slab_bytes);
 
-    std::size_t unique_key_count;  // Number of unique keys.
-    std::size_t pair_count;        // Total number of key-value pairs.
-    std::size_t mode_count;        // Number of pairs with a most frequent key.
 
+    // Remove the working files in the background, as it may take long for large files. The checkpoint goes first
+    // and at once, so that the collation is never taken to be resumable with its files being removed.
+    close_checkpoint();
+    if(checkpointing)
+        Work_File_Remover::remove_files({checkpoint_file_path()});
 
-    Aggregate_Result(): unique_key_count(0), pair_count(0), mode_count(0)
-    {}
+    Work_File_Remover::instance().submit(work_file_pref, work_file_paths());
+}
 
 
-public:
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline std::vector<std::string> Key_Value_Collator<T_key_, T_val_, T_hasher_>::work_file_paths() const
+{
+    std::vector<std::string> path;
+
+    // The partition-files. A single-file collation has removed them already, and a persisted one has its own links
+    // to them.
+    for(std::size_t p_id = 0; p_id < partition_count && output_file_path.empty(); ++p_id)
+        if(output_format == Output_Format::grouped)
+        {
+            path.emplace_back(grouped_file_path(p_id, key_file_ext));
+            path.emplace_back(grouped_file_path(p_id, offset_file_ext));
+            path.emplace_back(grouped_file_path(p_id, val_file_ext));
+        }
+        else
+            path.emplace_back(partition_file_path(p_id));
+
+    // The deposits apart from the collated partitions, if not collated.
+    for(std::size_t p_id = 0; p_id < partition_count && !output_pref.empty(); ++p_id)
+        path.emplace_back(spill_file_path(p_id));
+
+    // The pairs received from the other processes of an exchange, if not collated.
+    for(std::size_t p_id = 0; p_id < partition_count && exchange_count > 1; ++p_id)
+        for(std::size_t rank = 0; rank < exchange_count && partition_owner(p_id) == exchange_rank; ++rank)
+            if(rank != exchange_rank)
+                path.emplace_back(exchange_file_path(p_id, rank));
+
+    // The deposits in the fast spill tier before overflows, if not collated.
+    for(std::size_t p_id = 0; p_id < partition_count && !spill_tier_pref.empty(); ++p_id)
+        if(partition_overflow[p_id])
+            path.emplace_back(fast_file_path(p_id));
+
+    // The child runs of the partitions split, but not collated.
+    for(std::size_t p_id = 0; p_id < partition_count; ++p_id)
+        for(std::size_t c_id = 0; c_id < split_fanout && partition_split[p_id]; ++c_id)
+            path.emplace_back(split_file_path(p_id, c_id));
+
+    // The runs of deposits not merged into the collation.
+    for(std::size_t p_id = 0; p_id < partition_count && incremental; ++p_id)
+        path.emplace_back(run_file_path(p_id));
+
+    // The last buffers of the partitions, if not collated.
+    for(std::size_t i = 0; i < stripe_pref.size(); ++i)
+        path.emplace_back(tail_file_path(i));
+
+    // The collation is not to be resumed anymore.
+    if(checkpointing)
+        path.emplace_back(checkpoint_file_path());
+
+    return path;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::close_checkpoint()
+{
+    if(checkpoint_fd >= 0)
+    {
+        close(checkpoint_fd);
+        checkpoint_fd = -1;
+    }
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::remove_work_files()
+{
+    close_checkpoint();
+    Work_File_Remover::remove_files(work_file_paths());
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::reopen_deposit_stream()
+{
+    if(buf_pool.full_buf_count() > 0 || buf_pool.free_buf_count() != buf_count || (mapper != nullptr && mapper->joinable()))
+    {
+        std::cerr << "Deposit stream reopened while it is open. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    if(layout == nullptr || !output_file_path.empty() || incremental || persisted || checkpointing)
+    {
+        std::cerr << "Deposit stream can only be reopened after a non-persisted, non-checkpointed collation into partition files in the pairs format. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    if(exchange_count > 1)
+    {
+        std::cerr << "Deposit streams of collations spread over processes can not be reopened. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    incremental = true;
+    agg_result = Aggregate_Result();    // The aggregates are recomputed over the merged collation.
+
+    // The runs are created at their first flushes, so stale ones from earlier collations at the same path-prefix are
+    // removed.
+    std::vector<std::string> stale_path;
+    for(std::size_t p_id = 0; p_id < partition_count; ++p_id)
+        stale_path.emplace_back(run_file_path(p_id));
+    Work_File_Remover::remove_files(stale_path);
+
+    stream_incoming = true;
+    delete mapper;
+    mapper = new std::thread(&Key_Value_Collator<T_key_, T_val_, T_hasher_>::map, this);
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::reset()
+{
+    if(buf_pool.full_buf_count() > 0 || buf_pool.free_buf_count() != buf_count || (mapper != nullptr && mapper->joinable()))
+    {
+        std::cerr << "Collator reset while the deposit stream is open. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    if(persisted)
+    {
+        std::cerr << "Persisted collations can not be reset. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    // Fresh partition-files are created instead of truncating the existing ones, for the same reason as in
+    // `collate_partition`. These are removed synchronously, as the next round creates files at the same paths.
+    remove_work_files();
+
+    std::fill(partition_spill_bytes.begin(), partition_spill_bytes.end(), 0);
+    std::fill(partition_split.begin(), partition_split.end(), 0);
+    std::fill(tail_count.begin(), tail_count.end(), 0);
+    std::fill(partition_overflow.begin(), partition_overflow.end(), 0);
+    fast_spill_bytes = disk_spill_bytes = 0;
+    exchange_count = 1;
+    exchange_rank = 0;
+    layout.reset();
+    output_file_path.clear();
+    output_file_offset.clear();
+    aggregated = false;
+    incremental = false;
+    output_format = Output_Format::pairs;
+    agg_result = Aggregate_Result();
+
+    // The mapper exits at the end of each deposit stream, as it busy-waits for buffers while alive.
+    stream_incoming = true;
+    delete mapper;
+    mapper = new std::thread(&Key_Value_Collator<T_key_, T_val_, T_hasher_>::map, this);
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline typename Key_Value_Collator<T_key_, T_val_, T_hasher_>::buf_t& Key_Value_Collator<T_key_, T_val_, T_hasher_>::get_buffer()
+{
+    buf_t* buf_p;
+    while(!buf_pool.fetch_free_buf(buf_p));
+
+    return *buf_p;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::return_buffer(buf_t& buf)
+{
+    buf_pool.return_full_buffer(&buf);
+
+    Shared_Buffer_Pool<T_key_, T_val_>* const sp = shared_pool.load();
+    if(sp != nullptr)   // The mapper may be sleeping on the shared pool.
+        sp->notify_full();
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::open_shared_deposit_channel(const std::string& channel_path, const std::size_t buf_count, const std::size_t buf_capacity)
+{
+    if(mapper == nullptr || !stream_incoming)
+    {
+        std::cerr << "Shared deposit channels can only be opened during a deposit stream. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    if(shared_pool.load() != nullptr)
+    {
+        std::cerr << "A shared deposit channel is already open. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    shared_pool = new Shared_Buffer_Pool<T_key_, T_val_>(channel_path, buf_count, buf_capacity);
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline const std::string Key_Value_Collator<T_key_, T_val_, T_hasher_>::partition_file_path(const std::size_t p_id) const
+{
+    return collated_pref(p_id) + "." + std::to_string(p_id) + partition_file_ext;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline const std::string Key_Value_Collator<T_key_, T_val_, T_hasher_>::spill_file_path(const std::size_t p_id) const
+{
+    return partition_pref(p_id) + "." + std::to_string(p_id) + partition_file_ext;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::map()
+{
+    buf_t* buf_p;
+    typename Shared_Buffer_Pool<T_key_, T_val_>::Buffer shared_buf;
+    std::chrono::steady_clock::time_point deadline; // For the buffers of the shared pool still held once the stream is closed.
+
+    while(true)
+    {
+        // The shared pool's signal is read before looking for buffers, so that any returned afterwards void the wait.
+        Shared_Buffer_Pool<T_key_, T_val_>* const sp = shared_pool.load();
+        const uint32_t seq = (sp != nullptr ? sp->full_signal() : 0);
+        const bool incoming = stream_incoming;
+
+        if(buf_pool.fetch_full_buf(buf_p))
+        {
+            map_buffer(buf_p->data(), buf_p->size());
+
+            buf_p->clear();
+            buf_pool.return_free_buf(buf_p);
+        }
+        else if(sp != nullptr && sp->fetch_full_buf(shared_buf))
+        {
+            map_buffer(shared_buf.pairs, shared_buf.size);   // Read in place from the producer's memory.
+            sp->return_free_buf(shared_buf);
+        }
+        else if(!incoming && buf_pool.full_buf_count() == 0 && (sp == nullptr || sp->free_buf_count() == sp->buf_count()))
+            break;
+        else if(sp != nullptr)  // The producers of the shared pool wake the mapper; in-process ones notify it too.
+        {
+            // The producers are waited on for so long once the stream is closed, and not at all for the buffers
+            // held by the ones exited.
+            if(!incoming)
+            {
+                const auto now = std::chrono::steady_clock::now();
+                if(deadline == std::chrono::steady_clock::time_point())
+                    deadline = now + std::chrono::seconds(shared_channel_timeout_sec);
+
+                if(sp->holder_exited())
+                {
+                    std::cerr << "A producer of the shared deposit channel exited holding a buffer. Aborting.\n";
+                    std::exit(EXIT_FAILURE);
+                }
+
+                if(now >= deadline)
+                {
+                    std::cerr << "Not all buffers of the shared deposit channel were returned within " << shared_channel_timeout_sec
+                              << " seconds of the close of the deposit stream; " << sp->held_buf_count() << " are still held. Aborting.\n";
+                    std::exit(EXIT_FAILURE);
+                }
+            }
+
+            sp->wait_full(seq);
+        }
+    }
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::map_buffer(const key_val_pair_t* const pairs, const std::size_t count)
+{
+    for(std::size_t i = 0; i < count; ++i)
+    {
+        const key_val_pair_t& key_val_pair = pairs[i];
+        const std::size_t p_id = get_partition_id(key_val_pair.first);
+        if(exchange_count > 1 && partition_owner(p_id) != exchange_rank)    // Routed to the owner process.
+        {
+            const std::size_t owner = partition_owner(p_id);
+            exchange_buf[owner].emplace_back(key_val_pair);
+            if(exchange_buf[owner].size() == partition_buf_elem_th)
+                send_exchange_buf(owner);
+
+            continue;
+        }
+
+        const std::size_t s_id = (partition_split[p_id] ? split_stream_id(p_id, get_split_id(key_val_pair.first)) : p_id);
+        if(partition_buf[s_id] == nullptr)
+            partition_buf[s_id] = (spill_mode == Spill_Mode::mapped ? map_window(s_id) : acquire_partition_buf());
+
+        auto& s_buf_size = partition_buf_size[s_id];
+        partition_buf[s_id][s_buf_size++] = key_val_pair;
+
+        assert(s_buf_size <= partition_buf_elem_th);
+        if(s_buf_size == partition_buf_elem_th)
+            flush(s_id);
+    }
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::flush(const std::size_t s_id)
+{
+    const std::size_t bytes = partition_buf_size[s_id] * sizeof(key_val_pair_t);
+    if(spill_mode == Spill_Mode::mapped)
+        unmap_window(s_id);
+    else
+        submit_spill(s_id);
+
+    // The later pairs of a partition grown too large go to its child runs, each of which can be sorted in memory.
+    // Runs of incremental deposits are not split, as they are merged into the collated partitions as a whole.
+    if(s_id < partition_count && !incremental && partition_split_th > 0)
+    {
+        partition_spill_bytes[s_id] += bytes;
+        if(partition_spill_bytes[s_id] >= partition_split_th)
+            partition_split[s_id] = 1;
+    }
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::submit_spill(const std::size_t s_id)
+{
+    const std::size_t bytes = partition_buf_size[s_id] * sizeof(key_val_pair_t);
+
+    // A partition spilling into the full fast tier overflows into its work directory from this spill on, while the
+    // ones spilled earlier stay; incremental runs stay alongside their collated partitions.
+    bool reopen = false;
+    if(s_id < partition_count && !spill_tier_pref.empty() && !partition_overflow[s_id] && !incremental &&
+       fast_spill_bytes + bytes > spill_tier_cap)
+        partition_overflow[s_id] = reopen = true;
+
+    if(s_id < partition_count && !spill_tier_pref.empty() && !partition_overflow[s_id])
+        fast_spill_bytes += bytes;
+    else
+        disk_spill_bytes += bytes;
+
+    // The stream continues into a fresh buffer while the spill writer writes out this one. The file is chosen here,
+    // as the buffers queued before an overflow are still to go to the fast tier.
+    spill_writer[stream_stripe(s_id)]->submit(s_id, stream_file_path(s_id), partition_buf[s_id], partition_buf_size[s_id], reopen);
+    partition_buf[s_id] = nullptr;
+    partition_buf_size[s_id] = 0;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline typename Key_Value_Collator<T_key_, T_val_, T_hasher_>::key_val_pair_t* Key_Value_Collator<T_key_, T_val_, T_hasher_>::map_window(const std::size_t s_id)
+{
+    const std::size_t window_bytes = partition_buf_elem_th * sizeof(key_val_pair_t);
+    int& fd = partition_fd[s_id];
+
+    // The window is reserved in its spill tier, so that the windows mapped at once stay within the fast tier.
+    const bool tiered = (s_id < partition_count && !spill_tier_pref.empty() && !incremental);
+    if(tiered && !partition_overflow[s_id] && fast_spill_bytes + window_bytes > spill_tier_cap)
+    {
+        partition_overflow[s_id] = 1;
+        if(fd >= 0)
+            close(fd);
+
+        fd = -1;
+        stream_file_size[s_id] = 0;
+    }
+
+    (tiered && !partition_overflow[s_id] ? fast_spill_bytes : disk_spill_bytes) += window_bytes;
+
+    if(fd < 0)
+        fd = open(stream_file_path(s_id).c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    // The mapping starts at the page of the spilled bytes' end, which the window may start amid.
+    const off_t page_size = sysconf(_SC_PAGESIZE);
+    const off_t offset = stream_file_size[s_id];
+    const off_t map_offset = offset / page_size * page_size;
+    void* const mem = (fd < 0 || ftruncate(fd, offset + window_bytes) != 0 ? MAP_FAILED :
+                        mmap(nullptr, offset - map_offset + window_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, map_offset));
+    if(mem == MAP_FAILED)
+    {
+        std::cerr << "Error mapping partition file(s) of the collator. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    return reinterpret_cast<key_val_pair_t*>(static_cast<char*>(mem) + (offset - map_offset));
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::unmap_window(const std::size_t s_id)
+{
+    const std::size_t window_bytes = partition_buf_elem_th * sizeof(key_val_pair_t);
+    const std::size_t bytes = partition_buf_size[s_id] * sizeof(key_val_pair_t);
+    const int fd = partition_fd[s_id];
+
+    const off_t page_size = sysconf(_SC_PAGESIZE);
+    const off_t offset = stream_file_size[s_id];
+    const off_t map_offset = offset / page_size * page_size;
+    munmap(reinterpret_cast<char*>(partition_buf[s_id]) - (offset - map_offset), offset - map_offset + window_bytes);
+
+    // A window partially filled, at the end of the deposits, gives back its rest.
+    stream_file_size[s_id] += bytes;
+    if(bytes < window_bytes)
+    {
+        const bool tiered = (s_id < partition_count && !spill_tier_pref.empty() && !incremental);
+        (tiered && !partition_overflow[s_id] ? fast_spill_bytes : disk_spill_bytes) -= window_bytes - bytes;
+        if(ftruncate(fd, stream_file_size[s_id]) != 0)
+        {
+            std::cerr << "Error writing to partition file(s) of the collator. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    write_limiter.acquire(bytes);
+    drop_pages(fd, offset, bytes);
+
+    partition_buf[s_id] = nullptr;
+    partition_buf_size[s_id] = 0;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline std::size_t Key_Value_Collator<T_key_, T_val_, T_hasher_>::get_partition_id(const T_key_& key) const
+{
+    return hash(key) & (partition_count - 1);
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline std::size_t Key_Value_Collator<T_key_, T_val_, T_hasher_>::get_split_id(const T_key_& key) const
+{
+    return (static_cast<std::size_t>(hash(key)) >> partition_id_bits) & (split_fanout - 1);
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::close_deposit_stream()
+{
+    if(mapper == nullptr)
+    {
+        std::cerr << "Resumed collators do not accept deposits. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    stream_incoming = false;
+    if(!mapper->joinable())
+    {
+        std::cerr << "Early termination encountered for the key-mapper thread. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    Shared_Buffer_Pool<T_key_, T_val_>* const sp = shared_pool.load();
+    if(sp != nullptr)
+        sp->notify_full();
+
+    mapper->join();
+
+    if(sp != nullptr)
+    {
+        sp->close();
+        shared_pool = nullptr;
+        delete sp;
+    }
+
+    if(exchange_count > 1)
+        close_exchange();
+
+
+    // Flush the remaining in-memory partition contents, release their memory, and close the in-disk partitions.
+    flush_tails();
+    for(std::size_t s_id = 0; s_id < stream_count; ++s_id)
+        if(partition_buf_size[s_id] > 0)
+            flush(s_id);
+
+    for(auto& writer : spill_writer)
+        writer->drain();
+
+    for(int& fd : partition_fd)
+        if(fd >= 0)
+        {
+            if(close(fd) != 0)
+            {
+                std::cerr << "Error closing the partition files of the collator. Aborting.\n";
+                std::exit(EXIT_FAILURE);
+            }
+
+            fd = -1;
+        }
+
+    std::fill(stream_file_size.begin(), stream_file_size.end(), 0);
+    release_partition_bufs();
+
+    if(checkpointing)
+        create_checkpoint();
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::collate(const uint32_t thread_count, const bool aggregate, const Output_Format format)
+{
+    if(incremental && format != Output_Format::pairs)
+    {
+        std::cerr << "Incremental collations are only supported in the pairs format. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    output_format = format;
+    aggregated = aggregate;
+
+    if(checkpointing)
+        checkpoint_collation(format, aggregate);
+
+    std::vector<std::size_t> p_pair_count(partition_count);
+    std::vector<std::pair<std::size_t, std::size_t>> p_mem; // Memory required to collate each partition, and its ID.
+    for(std::size_t p_id = 0; p_id < partition_count; ++p_id)
+        if(partition_collated(p_id))    // Collated before an interruption.
+        {
+            if(partition_split[p_id])
+                finish_split_partition(p_id, output_format == Output_Format::pairs && output_fd < 0);
+
+            const auto& entry = checkpoint_entry[p_id];
+            Aggregate_Result p_result;
+            p_pair_count[p_id] = entry.pair_count;
+            p_result.unique_key_count = entry.unique_key_count;
+            p_result.pair_count = (aggregate ? entry.pair_count : 0);
+            p_result.mode_count = entry.mode_count;
+            agg_result.aggregate(p_result);
+        }
+        else
+            p_mem.emplace_back(partition_collate_bytes(p_id), p_id);
+
+    Collate_Scheduler scheduler(std::move(p_mem), collate_mem_cap, stripe_pref.size());
+    std::vector<std::thread> worker;
+    std::vector<Aggregate_Result> worker_aggregate(thread_count, Aggregate_Result());
+    for(uint32_t t_id = 0; t_id < thread_count; ++t_id)
+        worker.emplace_back(
+            [this, aggregate, &p_pair_count, &scheduler](Aggregate_Result& result)
+            // Collates the partitions handed out by the scheduler.
+            {
+                Aggregate_Result result_local;  // To avoid possible false-sharing.
+                apply_io_priority(io_prio);
+
+                std::size_t p_id, bytes;
+                while(scheduler.acquire(p_id, bytes))
+                {
+                    // The memory is mapped per partition and unmapped right after, so that it is within the cap.
+                    void* const mem = (bytes > 0 ? mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) : nullptr);
+                    if(mem == MAP_FAILED)
+                    {
+                        std::cerr << "Error allocating memory for collating a partition. Aborting.\n";
+                        std::exit(EXIT_FAILURE);
+                    }
+
+                    Aggregate_Result p_result;
+                    p_pair_count[p_id] = collate_partition(p_id, static_cast<key_val_pair_t*>(mem), aggregate, p_result);
+                    result_local.aggregate(p_result);
+
+                    if(mem != nullptr)
+                        munmap(mem, bytes);
+
+                    scheduler.release(p_id, bytes);
+                }
+
+                result = result_local;
+            },
+            std::ref(worker_aggregate[t_id])
+        );
+
+
+    for(uint32_t t_id = 0; t_id < thread_count; ++t_id)
+    {
+        if(!worker[t_id].joinable())
+        {
+            std::cerr << "Early termination encountered for a collator thread. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        worker[t_id].join();
+        agg_result.aggregate(worker_aggregate[t_id]);
+    }
+
+
+    // The tail files are read whole by now.
+    if(std::find_if(tail_count.begin(), tail_count.end(), [](const std::size_t count){ return count > 0; }) != tail_count.end())
+    {
+        std::vector<std::string> tail_path;
+        for(std::size_t i = 0; i < stripe_pref.size(); ++i)
+            tail_path.emplace_back(tail_file_path(i));
+
+        Work_File_Remover::remove_files(tail_path);
+        std::fill(tail_count.begin(), tail_count.end(), 0);
+    }
+
+    // The pair-based readers of the collation are available only for the pairs format.
+    if(format == Output_Format::pairs)
+        layout = make_layout(p_pair_count);
+
+    incremental = false;    // The runs of new deposits are merged into the collation.
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::collate_to_file(const std::string& file_path, const uint32_t thread_count, const bool aggregate)
+{
+    // The sorted partitions are as large as the deposited ones, so their offsets into the file are known beforehand.
+    const auto align = [](const uint64_t offset) { return (offset + collation_file_align - 1) / collation_file_align * collation_file_align; };
+
+    std::vector<Collation_File_Dir_Entry> dir(partition_count);
+    uint64_t offset = align(sizeof(Collation_File_Header) + partition_count * sizeof(Collation_File_Dir_Entry));
+    output_file_offset.resize(partition_count);
+    for(std::size_t p_id = 0; p_id < partition_count; ++p_id)
+    {
+        dir[p_id].offset = output_file_offset[p_id] = offset;
+        dir[p_id].pair_count = partition_pair_count(p_id);
+        offset = align(offset + dir[p_id].pair_count * sizeof(key_val_pair_t));
+    }
+
+    // A resumed collation keeps the partitions already written into the file.
+    const bool resuming = (checkpoint_fd >= 0 && checkpoint_header.phase == collation_phase_collating);
+    output_fd = open(file_path.c_str(), O_WRONLY | O_CREAT | (resuming ? 0 : O_TRUNC), 0644);
+    if(output_fd < 0 || ftruncate(output_fd, offset) != 0)
+    {
+        std::cerr << "Error creating the collation output file. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    if(checkpointing)
+        sync_parent_dir(file_path);
+
+    output_file_path = file_path;
+    collate(thread_count, aggregate, Output_Format::pairs);
+
+
+    // Write the header and the partition directory, now that the aggregates are known.
+    const Collation_File_Header header = make_header(0);
+    write_at(output_fd, &header, sizeof(header), 0);
+    write_at(output_fd, dir.data(), dir.size() * sizeof(Collation_File_Dir_Entry), sizeof(header));
+
+    if(close(output_fd) != 0)
+    {
+        std::cerr << "Error writing to the collation output file. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    output_fd = -1;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline Collation_File_Header Key_Value_Collator<T_key_, T_val_, T_hasher_>::make_header(const std::size_t path_table_size) const
+{
+    Collation_File_Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, collation_file_magic, sizeof(header.magic));
+    header.version = collation_file_version;
+    header.key_size = sizeof(T_key_);
+    header.val_size = sizeof(T_val_);
+    header.pair_size = sizeof(key_val_pair_t);
+    header.key_type_id = type_id<T_key_>();
+    header.val_type_id = type_id<T_val_>();
+    header.hasher_type_id = type_id<T_hasher_>();
+    header.path_table_size = path_table_size;
+    header.partition_count = partition_count;
+    header.pair_count = layout->pair_count();
+    header.aggregated = aggregated;
+    header.unique_key_count = agg_result.unique_key_count;
+    header.mode_count = agg_result.mode_count;
+
+    return header;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::persist(const std::string& manifest_path)
+{
+    if(layout == nullptr)
+    {
+        std::cerr << "Only collations in the pairs format can be persisted. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    // The partition files are linked to names apart from the working files', so that they outlive this collator and
+    // the later ones at the same path-prefix, which remove the working files. The names are keyed by the absolute
+    // manifest path: persisting to the same manifest again replaces the files, and to another one keeps them apart.
+    std::string abs_manifest_path = manifest_path;
+    if(manifest_path.empty() || manifest_path.front() != '/')
+    {
+        char* const cwd = getcwd(nullptr, 0);
+        if(cwd == nullptr)
+        {
+            std::cerr << "Error resolving the manifest path. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        abs_manifest_path = std::string(cwd) + "/" + manifest_path;
+        std::free(cwd);
+    }
+
+    uint64_t manifest_hash = 14695981039346656037ULL;   // FNV-1a.
+    for(const char c : abs_manifest_path)
+        manifest_hash = (manifest_hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+
+    char manifest_id[17];
+    std::snprintf(manifest_id, sizeof(manifest_id), "%016llx", static_cast<unsigned long long>(manifest_hash));
+
+    // The partition paths are made absolute, so that the manifest is usable from any working directory.
+    std::string path_table;
+    std::vector<Collation_File_Dir_Entry> dir(partition_count);
+    for(std::size_t p_id = 0; p_id < partition_count; ++p_id)
+    {
+        dir[p_id].offset = layout->file_offset[p_id];
+        dir[p_id].pair_count = layout->partition_size(p_id);
+        if(dir[p_id].pair_count == 0)   // Empty partitions have no files.
+        {
+            path_table.push_back('\0');
+            continue;
+        }
+
+        // A single-file collation is not a working file.
+        std::string path = layout->path[p_id];
+        if(output_file_path.empty())
+        {
+            const std::string d_path = dataset_file_path(p_id, manifest_id);
+            if((std::remove(d_path.c_str()) != 0 && errno != ENOENT) || link(path.c_str(), d_path.c_str()) != 0)
+            {
+                std::cerr << "Error linking the persisted partition files. Aborting.\n";
+                std::exit(EXIT_FAILURE);
+            }
+
+            path = d_path;
+        }
+
+        char* const abs_path = realpath(path.c_str(), nullptr);
+        if(abs_path == nullptr)
+        {
+            std::cerr << "Error resolving the partition file paths. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        path_table.append(abs_path).push_back('\0');
+        std::free(abs_path);
+    }
+
+    const Collation_File_Header header = make_header(path_table.size());
+    std::ofstream output(manifest_path.c_str(), std::ios::out | std::ios::binary);
+    if(!output.write(reinterpret_cast<const char*>(&header), sizeof(header)) ||
+       !output.write(reinterpret_cast<const char*>(dir.data()), dir.size() * sizeof(Collation_File_Dir_Entry)) ||
+       !output.write(path_table.data(), path_table.size()))
+    {
+        std::cerr << "Error writing the collation manifest. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    output.close();
+    persisted = true;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline std::shared_ptr<const Collation_Layout> Key_Value_Collator<T_key_, T_val_, T_hasher_>::make_layout(const std::vector<std::size_t>& p_pair_count, const bool deposited) const
+{
+    auto l = std::make_shared<Collation_Layout>();
+    l->pair_offset.resize(partition_count + 1, 0);
+    for(std::size_t p_id = 0; p_id < partition_count; ++p_id)
+    {
+        l->path.emplace_back(deposited ? deposit_file_path(p_id) : output_file_path.empty() ? partition_file_path(p_id) : output_file_path);
+        l->file_offset.emplace_back(output_file_path.empty() ? 0 : output_file_offset[p_id]);
+        l->pair_offset[p_id + 1] = l->pair_offset[p_id] + p_pair_count[p_id];
+    }
+
+    // The deposits in the tail files follow the ones of all the partitions, so that the partitions' indices stay.
+    for(std::size_t p_id = 0; p_id < partition_count && deposited; ++p_id)
+        if(tail_count[p_id] > 0)
+        {
+            l->path.emplace_back(tail_file_path(stream_stripe(p_id)));
+            l->file_offset.emplace_back(tail_offset[p_id]);
+            l->pair_offset.emplace_back(l->pair_offset.back() + tail_count[p_id]);
+        }
+
+    l->read_once = (page_cache_policy == Page_Cache_Policy::drop);
+    return l;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::write_vec(const int fd, iovec* iov, std::size_t iov_count)
+{
+    while(iov_count > 0)
+    {
+        const ssize_t w = writev(fd, iov, std::min<std::size_t>(iov_count, IOV_MAX));
+        if(w < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            std::cerr << "Error writing to partition file(s) of the collator. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        // Skip the buffers written, and into the one written partially, if any.
+        std::size_t bytes = w;
+        for(; iov_count > 0 && bytes >= iov->iov_len; ++iov, --iov_count)
+            bytes -= iov->iov_len;
+
+        if(iov_count > 0)
+        {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + bytes;
+            iov->iov_len -= bytes;
+        }
+    }
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::read_at(const int fd, void* const buf, const std::size_t bytes, const off_t offset)
+{
+    char* const dst = static_cast<char*>(buf);
+    std::size_t bytes_read = 0;
+    while(bytes_read < bytes)
+    {
+        const ssize_t r = pread(fd, dst + bytes_read, bytes - bytes_read, offset + bytes_read);
+        if(r <= 0)
+        {
+            if(r < 0 && errno == EINTR)
+                continue;
+
+            std::cerr << "Error reading the partition files. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        bytes_read += r;
+    }
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::write_at(const int fd, const void* const buf, const std::size_t bytes, const off_t offset)
+{
+    const char* const src = static_cast<const char*>(buf);
+    std::size_t bytes_written = 0;
+    while(bytes_written < bytes)
+    {
+        const ssize_t w = pwrite(fd, src + bytes_written, bytes - bytes_written, offset + bytes_written);
+        if(w < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            std::cerr << "Error writing to the collation output file. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        bytes_written += w;
+    }
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline off_t Key_Value_Collator<T_key_, T_val_, T_hasher_>::file_size(const std::string& file_path)
+{
+    struct stat st;
+    return stat(file_path.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::sync_file(const std::string& file_path)
+{
+    const int fd = open(file_path.c_str(), O_RDONLY);
+    if(fd < 0 || fsync(fd) != 0 || close(fd) != 0)
+    {
+        std::cerr << "Error syncing files of the collator to disk. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::sync_parent_dir(const std::string& file_path)
+{
+    const std::size_t sep = file_path.find_last_of('/');
+    sync_file(sep == std::string::npos ? "." : (sep == 0 ? "/" : file_path.substr(0, sep)));
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::set_io_rate_limits(const std::size_t read_bytes_per_sec, const std::size_t write_bytes_per_sec)
+{
+    read_limiter.set_rate(read_bytes_per_sec);
+    write_limiter.set_rate(write_bytes_per_sec);
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline bool Key_Value_Collator<T_key_, T_val_, T_hasher_>::set_io_priority(const IO_Priority_Class io_class, const int level)
+{
+    if(level < 0 || level > 7)
+    {
+        std::cerr << "Invalid I/O priority level " << level << ". Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    // The class none takes no level.
+    const int ioprio = (static_cast<int>(io_class) << io_prio_class_shift) | (io_class == IO_Priority_Class::none ? 0 : level);
+
+    // The priority is tried on the calling thread, which then gets its own back, so that it is known to be permitted
+    // before the threads of the collator take it.
+    constexpr int ioprio_who_process = 1;
+    const long curr_prio = syscall(SYS_ioprio_get, ioprio_who_process, 0);
+    if(curr_prio < 0 || !apply_io_priority(ioprio))
+        return false;
+
+    apply_io_priority(static_cast<int>(curr_prio));
+    io_prio = ioprio;
+    return true;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline typename Key_Value_Collator<T_key_, T_val_, T_hasher_>::IO_Stats Key_Value_Collator<T_key_, T_val_, T_hasher_>::io_stats() const
+{
+    IO_Stats stats;
+    stats.bytes_read = read_limiter.bytes();
+    stats.bytes_written = write_limiter.bytes();
+    stats.read_throttle_time = read_limiter.throttle_time();
+    stats.write_throttle_time = write_limiter.throttle_time();
+
+    return stats;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline bool Key_Value_Collator<T_key_, T_val_, T_hasher_>::apply_io_priority(const int ioprio)
+{
+    // `IOPRIO_WHO_PROCESS` with the ID 0 is the calling thread.
+    constexpr int ioprio_who_process = 1;
+    return syscall(SYS_ioprio_set, ioprio_who_process, 0, ioprio) == 0;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::drop_pages(const int fd, const off_t offset, const off_t bytes) const
+{
+    if(page_cache_policy != Page_Cache_Policy::drop)
+        return;
+
+    // Both are hints; the pages still dirty are dropped at a later call, once written back.
+    sync_file_range(fd, offset, bytes, SYNC_FILE_RANGE_WRITE);
+    posix_fadvise(fd, offset, bytes, POSIX_FADV_DONTNEED);
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::drop_pages(const std::string& file_path) const
+{
+    if(page_cache_policy != Page_Cache_Policy::drop)
+        return;
+
+    const int fd = open(file_path.c_str(), O_RDONLY);
+    if(fd >= 0)
+    {
+        drop_pages(fd);
+        close(fd);
+    }
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline std::size_t Key_Value_Collator<T_key_, T_val_, T_hasher_>::partition_pair_count(const std::size_t p_id) const
+{
+    // A collated partition may have been moved out of its deposited file.
+    if(partition_collated(p_id))
+        return checkpoint_entry[p_id].pair_count;
+
+    off_t bytes = (incremental ? file_size(partition_file_path(p_id)) : 0);
+    for(const auto& path : deposit_file_paths(p_id))
+        bytes += file_size(path);
+
+    for(std::size_t c_id = 0; c_id < split_fanout && partition_split[p_id]; ++c_id)
+        bytes += file_size(split_file_path(p_id, c_id));
+
+    return bytes / sizeof(key_val_pair_t) + tail_count[p_id];
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline off_t Key_Value_Collator<T_key_, T_val_, T_hasher_>::partition_collate_bytes(const std::size_t p_id) const
+{
+    if(partition_split[p_id])
+        return split_run_bytes(p_id);
+
+    off_t bytes = tail_count[p_id] * sizeof(key_val_pair_t);
+    for(const auto& path : deposit_file_paths(p_id))
+        bytes += file_size(path);
+
+    return bytes;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline off_t Key_Value_Collator<T_key_, T_val_, T_hasher_>::split_run_bytes(const std::size_t p_id) const
+{
+    off_t pre_bytes = 0;
+    for(const auto& path : deposit_file_paths(p_id))
+        pre_bytes += file_size(path);
+
+    off_t child_bytes = 0;
+    for(std::size_t c_id = 0; c_id < split_fanout; ++c_id)
+        child_bytes = std::max(child_bytes, file_size(split_file_path(p_id, c_id)));
+
+    // A run holds a pair at least, so that the pairs before the split are sorted in runs even with no child runs.
+    const off_t run_bytes = std::max(child_bytes, std::min(pre_bytes, static_cast<off_t>(partition_split_th)));
+    return std::max(run_bytes, static_cast<off_t>(sizeof(key_val_pair_t)));
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline const std::string Key_Value_Collator<T_key_, T_val_, T_hasher_>::fast_file_path(const std::size_t p_id) const
+{
+    return spill_tier_pref + "." + std::to_string(p_id) + partition_file_ext;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline std::vector<std::string> Key_Value_Collator<T_key_, T_val_, T_hasher_>::deposit_file_paths(const std::size_t p_id) const
+{
+    std::vector<std::string> path;
+    if(!spill_tier_pref.empty() && partition_overflow[p_id])
+        path.emplace_back(fast_file_path(p_id));
+
+    for(std::size_t rank = 0; rank < exchange_count && partition_owner(p_id) == exchange_rank; ++rank)
+        if(rank != exchange_rank)
+            path.emplace_back(exchange_file_path(p_id, rank));
+
+    path.emplace_back(deposit_file_path(p_id));
+    return path;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::set_partition_exchange(const std::string& exchange_pref, const std::size_t process_count, const std::size_t rank)
+{
+    if(process_count == 0 || rank >= process_count)
+    {
+        std::cerr << "Invalid rank " << rank << " among " << process_count << " processes for the partition exchange. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    if(checkpointing || incremental)
+    {
+        std::cerr << "Partition exchanges are not supported with checkpointing or reopened deposit streams. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    exchange_count = process_count;
+    exchange_rank = rank;
+    if(process_count == 1)
+        return;
+
+    const auto socket_addr = [&exchange_pref](const std::size_t r)
+        {
+            const std::string path = exchange_pref + "." + std::to_string(r) + ".sock";
+            sockaddr_un addr;
+            std::memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            if(path.size() >= sizeof(addr.sun_path))
+            {
+                std::cerr << "Path-prefix of the partition exchange sockets is too long. Aborting.\n";
+                std::exit(EXIT_FAILURE);
+            }
+
+            std::strcpy(addr.sun_path, path.c_str());
+            return addr;
+        };
+
+
+    // The files of the received pairs are created at the first pairs from each process, so stale ones from earlier
+    // exchanges at the same path-prefix are removed.
+    std::vector<std::string> stale_path;
+    for(std::size_t p_id = 0; p_id < partition_count; ++p_id)
+        for(std::size_t r = 0; r < process_count && partition_owner(p_id) == rank; ++r)
+            if(r != rank)
+                stale_path.emplace_back(exchange_file_path(p_id, r));
+    Work_File_Remover::remove_files(stale_path);
+
+    // The other processes are waited for until a deadline, so that one failing to start does not hang the others.
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(exchange_timeout_sec);
+
+    // Listen for the other processes first, so that their connections are queued until accepted below.
+    const sockaddr_un listen_addr = socket_addr(rank);
+    unlink(listen_addr.sun_path);   // Stale from an earlier exchange.
+    const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listen_fd < 0 || bind(listen_fd, reinterpret_cast<const sockaddr*>(&listen_addr), sizeof(listen_addr)) != 0 ||
+       listen(listen_fd, process_count) != 0)
+    {
+        std::cerr << "Error setting up the partition exchange socket. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+
+    // Connect to each of the other processes, as soon as it listens, and introduce this one by its rank.
+    exchange_fd.assign(process_count, -1);
+    exchange_buf.assign(process_count, buf_t());
+    for(std::size_t r = 0; r < process_count; ++r)
+        if(r != rank)
+        {
+            const sockaddr_un addr = socket_addr(r);
+            while(true)
+            {
+                exchange_fd[r] = socket(AF_UNIX, SOCK_STREAM, 0);
+                if(exchange_fd[r] >= 0 && connect(exchange_fd[r], reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0)
+                    break;
+
+                if(exchange_fd[r] < 0 || (errno != ENOENT && errno != ECONNREFUSED))
+                {
+                    std::cerr << "Error connecting to the partition exchange. Aborting.\n";
+                    std::exit(EXIT_FAILURE);
+                }
+
+                if(std::chrono::steady_clock::now() >= deadline)
+                {
+                    std::cerr << "Timed out waiting for the process of rank " << r << " to join the partition exchange. Aborting.\n";
+                    std::exit(EXIT_FAILURE);
+                }
+
+                close(exchange_fd[r]);
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+
+            const uint64_t own_rank = rank;
+            if(send(exchange_fd[r], &own_rank, sizeof(own_rank), MSG_NOSIGNAL) != sizeof(own_rank))
+            {
+                std::cerr << "Error connecting to the partition exchange. Aborting.\n";
+                std::exit(EXIT_FAILURE);
+            }
+        }
+
+
+    // Accept the connections of the other processes, each to be received from in the background. Each of the other
+    // ranks is to connect exactly once.
+    std::vector<bool> joined(process_count, false);
+    joined[rank] = true;
+    for(std::size_t i = 1; i < process_count; ++i)
+    {
+        pollfd listen_poll{listen_fd, POLLIN, 0};
+        int ready;
+        do
+        {
+            const auto wait_ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            ready = poll(&listen_poll, 1, static_cast<int>(std::max<decltype(wait_ms)>(wait_ms, 0)));
+        }
+        while(ready < 0 && errno == EINTR);
+
+        if(ready == 0)
+        {
+            std::cerr << "Timed out waiting for the other processes to join the partition exchange. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        const int fd = (ready > 0 ? accept(listen_fd, nullptr, nullptr) : -1);
+        uint64_t peer_rank;
+        if(fd < 0 || recv(fd, &peer_rank, sizeof(peer_rank), MSG_WAITALL) != sizeof(peer_rank))
+        {
+            std::cerr << "Error accepting a connection to the partition exchange. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        if(peer_rank >= process_count || joined[peer_rank])
+        {
+            std::cerr << "Invalid or duplicate rank " << peer_rank << " joining the partition exchange. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        joined[peer_rank] = true;
+        exchange_receiver.emplace_back(&Key_Value_Collator::receive_exchange, this, fd, peer_rank);
+    }
+
+    close(listen_fd);
+    unlink(listen_addr.sun_path);
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::send_exchange_buf(const std::size_t rank)
+{
+    const char* const src = reinterpret_cast<const char*>(exchange_buf[rank].data());
+    const std::size_t bytes = exchange_buf[rank].size() * sizeof(key_val_pair_t);
+    for(std::size_t sent = 0; sent < bytes; )
+    {
+        const ssize_t s = send(exchange_fd[rank], src + sent, bytes - sent, MSG_NOSIGNAL);
+        if(s < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            std::cerr << "Error sending pairs to the partition exchange. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        sent += s;
+    }
+
+    exchange_buf[rank].clear();
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::receive_exchange(const int fd, const std::size_t rank)
+{
+    // The received pairs are buffered per partition and spilled into files of their own, never into the mapper's
+    // partition buffers: so that a receiver never waits for the mapper, which may be waiting for the receivers of
+    // the other processes.
+    constexpr std::size_t p_buf_elem_count = partition_buf_elem_th / 16;
+    std::vector<buf_t> p_buf(partition_count);
+    std::vector<std::ofstream> output(partition_count);
+    const auto spill = [&](const std::size_t p_id)
+        {
+            if(!output[p_id].is_open())
+                output[p_id].open(exchange_file_path(p_id, rank).c_str(), std::ios::out | std::ios::binary);
+
+            write_limiter.acquire(p_buf[p_id].size() * sizeof(key_val_pair_t));
+            if(!output[p_id].write(reinterpret_cast<const char*>(p_buf[p_id].data()), p_buf[p_id].size() * sizeof(key_val_pair_t)))
+            {
+                std::cerr << "Error writing to partition file(s) of the collator. Aborting.\n";
+                std::exit(EXIT_FAILURE);
+            }
+
+            p_buf[p_id].clear();
+        };
+
+    buf_t chunk(partition_buf_elem_th);
+    char* const chunk_bytes = reinterpret_cast<char*>(chunk.data());
+    std::size_t filled = 0;  // Bytes in the chunk; a pair may be received partially.
+    while(true)
+    {
+        const ssize_t r = recv(fd, chunk_bytes + filled, chunk.size() * sizeof(key_val_pair_t) - filled, 0);
+        if(r < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            std::cerr << "Error receiving pairs from the partition exchange. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        if(r == 0)  // The process has closed its deposit stream.
+            break;
+
+        filled += r;
+        const std::size_t count = filled / sizeof(key_val_pair_t);
+        for(std::size_t i = 0; i < count; ++i)
+        {
+            const std::size_t p_id = get_partition_id(chunk[i].first);
+            if(partition_owner(p_id) != exchange_rank)
+            {
+                std::cerr << "Pairs received for a partition of another process of the exchange. Aborting.\n";
+                std::exit(EXIT_FAILURE);
+            }
+
+            p_buf[p_id].emplace_back(chunk[i]);
+            if(p_buf[p_id].size() == p_buf_elem_count)
+                spill(p_id);
+        }
+
+        filled -= count * sizeof(key_val_pair_t);
+        std::memmove(chunk_bytes, chunk_bytes + count * sizeof(key_val_pair_t), filled);
+    }
+
+    if(filled > 0)
+    {
+        std::cerr << "Partial pair received from the partition exchange. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    for(std::size_t p_id = 0; p_id < partition_count; ++p_id)
+        if(!p_buf[p_id].empty())
+            spill(p_id);
+
+    close(fd);
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::close_exchange()
+{
+    // Closing a socket ends the stream of pairs to its process.
+    for(std::size_t rank = 0; rank < exchange_count; ++rank)
+        if(exchange_fd[rank] >= 0)
+        {
+            send_exchange_buf(rank);
+            close(exchange_fd[rank]);
+        }
+
+    for(auto& receiver : exchange_receiver)
+        receiver.join();
+
+    exchange_fd.clear();
+    exchange_buf.clear();
+    exchange_receiver.clear();
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline const std::string Key_Value_Collator<T_key_, T_val_, T_hasher_>::exchange_file_path(const std::size_t p_id, const std::size_t rank) const
+{
+    return stripe_pref[p_id % stripe_pref.size()] + "." + std::to_string(p_id) + "." + std::to_string(rank) + exchange_file_ext;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::set_output_file_prefs(const std::vector<std::string>& output_file_prefs)
+{
+    if(incremental)
+    {
+        std::cerr << "The output directories can not be changed for incremental collations. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    output_pref = output_file_prefs;
+
+    // Stale partition files in the output directories would be taken for collated partitions without deposits.
+    std::vector<std::string> stale_path;
+    for(std::size_t p_id = 0; p_id < partition_count && !output_pref.empty(); ++p_id)
+        if(!partition_collated(p_id))
+            stale_path.emplace_back(partition_file_path(p_id));
+    Work_File_Remover::remove_files(stale_path);
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::set_spill_tier(const std::string& fast_pref, const std::size_t capacity)
+{
+    if(checkpointing)
+    {
+        std::cerr << "Fast spill tiers are not supported with checkpointing. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    spill_tier_pref = fast_pref;
+    spill_tier_cap = capacity;
+
+    // Stale partition files in the tier would be taken for deposits.
+    std::vector<std::string> stale_path;
+    for(std::size_t p_id = 0; p_id < partition_count; ++p_id)
+        stale_path.emplace_back(fast_file_path(p_id));
+    Work_File_Remover::remove_files(stale_path);
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline typename Key_Value_Collator<T_key_, T_val_, T_hasher_>::Spill_Residency Key_Value_Collator<T_key_, T_val_, T_hasher_>::spill_residency() const
+{
+    Spill_Residency residency;
+    residency.fast_bytes = fast_spill_bytes;
+    residency.disk_bytes = disk_spill_bytes;
+    residency.fast_partition_count = residency.disk_partition_count = 0;
+    for(std::size_t p_id = 0; p_id < partition_count; ++p_id)
+        if(!spill_tier_pref.empty() && !partition_overflow[p_id] && !partition_split[p_id])
+            residency.fast_partition_count += (file_size(fast_file_path(p_id)) > 0);
+        else
+            residency.disk_partition_count += (partition_pair_count(p_id) > 0);
+
+    return residency;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline const std::string Key_Value_Collator<T_key_, T_val_, T_hasher_>::checkpoint_file_path() const
+{
+    return work_file_pref + checkpoint_file_ext;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline bool Key_Value_Collator<T_key_, T_val_, T_hasher_>::checkpoint_exists(const std::string& work_file_pref)
+{
+    struct stat st;
+    return stat((work_file_pref + checkpoint_file_ext).c_str(), &st) == 0;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::create_checkpoint()
+{
+    // The deposited partitions are made durable before being referred to by the checkpoint.
+    for(std::size_t p_id = 0; p_id < partition_count; ++p_id)
+    {
+        if(file_size(deposit_file_path(p_id)) > 0)  // Partitions without any deposit have no files.
+            sync_file(deposit_file_path(p_id));
+
+        for(std::size_t c_id = 0; c_id < split_fanout && partition_split[p_id]; ++c_id)
+            if(file_size(split_file_path(p_id, c_id)) > 0)
+                sync_file(split_file_path(p_id, c_id));
+    }
+
+    std::memset(&checkpoint_header, 0, sizeof(checkpoint_header));
+    std::memcpy(checkpoint_header.magic, collation_checkpoint_magic, sizeof(checkpoint_header.magic));
+    checkpoint_header.version = collation_checkpoint_version;
+    checkpoint_header.pair_size = sizeof(key_val_pair_t);
+    checkpoint_header.key_type_id = type_id<T_key_>();
+    checkpoint_header.val_type_id = type_id<T_val_>();
+    checkpoint_header.hasher_type_id = type_id<T_hasher_>();
+    checkpoint_header.partition_count = partition_count;
+    checkpoint_header.phase = collation_phase_deposited;
+
+    checkpoint_entry.assign(partition_count, Collation_Checkpoint_Entry());
+    for(std::size_t p_id = 0; p_id < partition_count; ++p_id)
+        checkpoint_entry[p_id].split = partition_split[p_id];
+
+    const std::string ckpt_path = checkpoint_file_path();
+    const std::string tmp_path = ckpt_path + ".tmp";
+    const int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+    {
+        std::cerr << "Error creating the checkpoint file. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    write_at(fd, &checkpoint_header, sizeof(checkpoint_header), 0);
+    write_at(fd, checkpoint_entry.data(), partition_count * sizeof(Collation_Checkpoint_Entry), sizeof(checkpoint_header));
+    if(fsync(fd) != 0 || close(fd) != 0 || std::rename(tmp_path.c_str(), ckpt_path.c_str()) != 0)
+    {
+        std::cerr << "Error creating the checkpoint file. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    sync_parent_dir(ckpt_path);
+
+    checkpoint_fd = open(ckpt_path.c_str(), O_WRONLY);
+    if(checkpoint_fd < 0)
+    {
+        std::cerr << "Error opening the checkpoint file. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::load_checkpoint()
+{
+    const std::string ckpt_path = checkpoint_file_path();
+    std::ifstream input(ckpt_path.c_str(), std::ios::in | std::ios::binary);
+    if(!input.read(reinterpret_cast<char*>(&checkpoint_header), sizeof(checkpoint_header)))
+    {
+        std::cerr << "No checkpoint found to resume the collation from. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    if(std::memcmp(checkpoint_header.magic, collation_checkpoint_magic, sizeof(checkpoint_header.magic)) != 0 ||
+       checkpoint_header.version != collation_checkpoint_version ||
+       checkpoint_header.pair_size != sizeof(key_val_pair_t) ||
+       checkpoint_header.key_type_id != type_id<T_key_>() || checkpoint_header.val_type_id != type_id<T_val_>() ||
+       checkpoint_header.hasher_type_id != type_id<T_hasher_>() ||
+       checkpoint_header.partition_count != partition_count)
+    {
+        std::cerr << "Checkpoint mismatches the collator. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    checkpoint_entry.resize(partition_count);
+    if(!input.read(reinterpret_cast<char*>(checkpoint_entry.data()), partition_count * sizeof(Collation_Checkpoint_Entry)))
+    {
+        std::cerr << "Error reading the checkpoint file. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    input.close();
+
+    checkpoint_fd = open(ckpt_path.c_str(), O_WRONLY);
+    if(checkpoint_fd < 0)
+    {
+        std::cerr << "Error opening the checkpoint file. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    // A split partition may have been interrupted after being checkpointed, before being moved into place; it is
+    // finished once the collation resumes, as its output directory is set up till then.
+    for(std::size_t p_id = 0; p_id < partition_count; ++p_id)
+        partition_split[p_id] = checkpoint_entry[p_id].split;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::checkpoint_collation(const Output_Format format, const bool aggregate)
+{
+    if(checkpoint_fd < 0)
+    {
+        std::cerr << "Checkpointed collations require the deposit stream to be closed first. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    const uint64_t single_file = !output_file_path.empty();
+    if(checkpoint_header.phase == collation_phase_collating &&
+        (checkpoint_header.output_format != static_cast<uint64_t>(format) || checkpoint_header.single_file != single_file || checkpoint_header.aggregate != aggregate))
+    {
+        std::cerr << "Resumed collation mismatches the interrupted one. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    checkpoint_header.phase = collation_phase_collating;
+    checkpoint_header.output_format = static_cast<uint64_t>(format);
+    checkpoint_header.single_file = single_file;
+    checkpoint_header.aggregate = aggregate;
+
+    write_at(checkpoint_fd, &checkpoint_header, sizeof(checkpoint_header), 0);
+    if(fdatasync(checkpoint_fd) != 0)
+    {
+        std::cerr << "Error syncing the checkpoint file. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::checkpoint_partition(const std::size_t p_id, const std::size_t pair_count, const Aggregate_Result& result)
+{
+    auto& entry = checkpoint_entry[p_id];
+    entry.pair_count = pair_count;
+    entry.unique_key_count = result.unique_key_count;
+    entry.mode_count = result.mode_count;
+    entry.collated = 1;
+
+    write_at(checkpoint_fd, &entry, sizeof(entry), sizeof(checkpoint_header) + p_id * sizeof(Collation_Checkpoint_Entry));
+    if(fdatasync(checkpoint_fd) != 0)
+    {
+        std::cerr << "Error syncing the checkpoint file. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline std::size_t Key_Value_Collator<T_key_, T_val_, T_hasher_>::collate_partition(const std::size_t p_id, key_val_pair_t* const p_data, const bool aggregate, Aggregate_Result& result)
+{
+    if(partition_split[p_id])
+        return collate_split_partition(p_id, p_data, aggregate, result);
+
+    // Read in the partition data to memory.
+
+    const std::string p_path = partition_file_path(p_id);
+    const std::string d_path = deposit_file_path(p_id);
+    off_t p_bytes = 0;
+
+    for(const auto& path : deposit_file_paths(p_id))
+    {
+        const auto bytes = file_size(path);
+        if(bytes == 0)  // Partitions without any deposit have no files.
+            continue;
+
+        read_limiter.acquire(bytes);
+        std::ifstream input(path.c_str(), std::ios::in | std::ios::binary);
+        if(!input.read(reinterpret_cast<char*>(p_data) + p_bytes, bytes))
+        {
+            std::cerr << "Error reading the partition files. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        input.close();
+        p_bytes += bytes;
+        // The inputs apart from the deposit file, i.e. the deposits in the fast spill tier before an overflow and the
+        // pairs received from the other processes of an exchange, are not needed once read.
+        if(path != d_path)
+            std::remove(path.c_str());
+        else if(checkpointing)  // Kept until the collated partition is durable, but not to be read again.
+            drop_pages(path);
+    }
+
+    // The last buffer of the partition, flushed into the tail file of its work directory with the others'.
+    if(tail_count[p_id] > 0)
+    {
+        const std::size_t bytes = tail_count[p_id] * sizeof(key_val_pair_t);
+        const int fd = open(tail_file_path(stream_stripe(p_id)).c_str(), O_RDONLY);
+        if(fd < 0)
+        {
+            std::cerr << "Error reading the partition files. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        read_limiter.acquire(bytes);
+        read_at(fd, reinterpret_cast<char*>(p_data) + p_bytes, bytes, tail_offset[p_id]);
+        close(fd);
+        p_bytes += bytes;
+    }
+
+
+    // Sort the partition data and optionally get aggregate statistics.
+    const std::size_t elem_count = p_bytes / sizeof(key_val_pair_t);
+    std::sort(p_data, p_data + elem_count);
+
+    if(incremental) // Only the new pairs are sorted; the collated ones are merged with them.
+    {
+        const std::size_t pair_count = merge_partition(p_id, p_data, elem_count, aggregate, result);
+        std::remove(d_path.c_str());
+        return pair_count;
+    }
+
+    if(aggregate && elem_count > 0) // Aggregate results from this partition.
+    {
+        T_key_ curr_key = p_data[0].first;
+        std::size_t curr_key_freq = 1;
+        result.unique_key_count++;
+
+        if(result.mode_count < 1)
+            result.mode_count = 1;
+
+        for(std::size_t i = 1; i < elem_count; ++i)
+            if(p_data[i].first != curr_key)
+            {
+                curr_key = p_data[i].first;
+                curr_key_freq = 1;
+                result.unique_key_count++;
+            }
+            else
+                if(result.mode_count < ++curr_key_freq)
+                    result.mode_count = curr_key_freq;
+
+        result.pair_count += elem_count;
+    }
+
+
+    // Write the partition data back to disk.
+
+    if(elem_count == 0) // Empty partitions stay without files.
+    {
+        if(checkpointing)
+            checkpoint_partition(p_id, 0, result);
+
+        return 0;
+    }
+
+    if(checkpointing)   // The deposited partition is kept until its collated form is durable.
+    {
+        if(output_format == Output_Format::grouped)
+        {
+            Partition_Writer output(*this, p_id);
+            output.write(p_data, elem_count);
+            output.close(true);
+        }
+        else if(output_fd >= 0)
+        {
+            write_limiter.acquire(p_bytes);
+            write_at(output_fd, p_data, p_bytes, output_file_offset[p_id]);
+            if(fdatasync(output_fd) != 0)
+            {
+                std::cerr << "Error syncing the collation output file. Aborting.\n";
+                std::exit(EXIT_FAILURE);
+            }
+
+            drop_pages(output_fd, output_file_offset[p_id], p_bytes);
+        }
+        else    // Replaced atomically, as an interrupted overwrite would lose pairs.
+        {
+            const std::string tmp_path = p_path + ".tmp";
+            const int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if(fd < 0)
+            {
+                std::cerr << "Error writing to the partition files. Aborting.\n";
+                std::exit(EXIT_FAILURE);
+            }
+
+            write_limiter.acquire(p_bytes);
+            write_at(fd, p_data, p_bytes, 0);
+            if(fdatasync(fd) != 0 || close(fd) != 0 || std::rename(tmp_path.c_str(), p_path.c_str()) != 0)
+            {
+                std::cerr << "Error writing to the partition files. Aborting.\n";
+                std::exit(EXIT_FAILURE);
+            }
+
+            sync_parent_dir(p_path);
+            drop_pages(p_path);
+        }
+
+        checkpoint_partition(p_id, elem_count, result);
+        if(output_format == Output_Format::grouped || output_fd >= 0 || d_path != p_path)
+            std::remove(d_path.c_str());
+
+        return elem_count;
+    }
+
+    std::remove(d_path.c_str());    // Remove the file, as ext4 fs driver close() waits before data
+                                    // are really written to the disk when done on an *existing* i-node.
+                                    // https://superuser.com/questions/865710/write-to-newfile-vs-overwriting-performance-issue
+    if(output_format == Output_Format::grouped)
+    {
+        Partition_Writer output(*this, p_id);
+        output.write(p_data, elem_count);
+        output.close(false);
+    }
+    else if(output_fd >= 0)
+    {
+        write_limiter.acquire(p_bytes);
+        write_at(output_fd, p_data, p_bytes, output_file_offset[p_id]);
+        drop_pages(output_fd, output_file_offset[p_id], p_bytes);
+    }
+    else
+    {
+        write_limiter.acquire(p_bytes);
+        std::ofstream output(p_path.c_str(), std::ios::out | std::ios::binary);
+        if(!output.write(reinterpret_cast<const char*>(p_data), p_bytes))
+        {
+            std::cerr << "Error writing to the partition files. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        output.close();
+        drop_pages(p_path);
+    }
+
+    return elem_count;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline std::size_t Key_Value_Collator<T_key_, T_val_, T_hasher_>::merge_partition(const std::size_t p_id, const key_val_pair_t* const p_data, const std::size_t elem_count, const bool aggregate, Aggregate_Result& result)
+{
+    const std::string p_path = partition_file_path(p_id);
+    const std::size_t base_count = file_size(p_path) / sizeof(key_val_pair_t);
+
+    // A partition without new pairs is kept as it is, unless it is to be moved into the single output file.
+    const bool rewrite = (elem_count > 0 || output_fd >= 0);
+    if(!rewrite && !aggregate)
+        return base_count;
+
+    std::ifstream input;
+    if(base_count > 0)  // Empty partitions have no files.
+        input.open(p_path.c_str(), std::ios::in | std::ios::binary);
+
+    const std::string tmp_path = p_path + ".tmp";
+    const int fd = (!rewrite ? -1 : output_fd >= 0 ? output_fd : open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+    if((base_count > 0 && !input) || (rewrite && fd < 0))
+    {
+        std::cerr << "Error opening the partition files for merging. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::vector<key_val_pair_t> base_buf(merge_buf_elem_count), out_buf;
+    out_buf.reserve(merge_buf_elem_count);
+    std::size_t base_idx = 0, base_buf_count = 0, base_read = 0;  // Cursor into the collated pairs.
+    std::size_t new_idx = 0;    // Cursor into the new pairs.
+    off_t out_off = (output_fd >= 0 ? output_file_offset[p_id] : 0);
+
+    T_key_ curr_key{};
+    std::size_t curr_key_freq = 0;
+    const auto emit = [&](const key_val_pair_t& kv)
+        {
+            if(aggregate)
+            {
+                if(curr_key_freq == 0 || kv.first != curr_key)
+                {
+                    curr_key = kv.first;
+                    curr_key_freq = 0;
+                    result.unique_key_count++;
+                }
+
+                if(result.mode_count < ++curr_key_freq)
+                    result.mode_count = curr_key_freq;
+            }
+
+            if(!rewrite)
+                return;
+
+            if(out_buf.size() == merge_buf_elem_count)
+            {
+                write_limiter.acquire(out_buf.size() * sizeof(key_val_pair_t));
+                write_at(fd, out_buf.data(), out_buf.size() * sizeof(key_val_pair_t), out_off);
+                out_off += out_buf.size() * sizeof(key_val_pair_t);
+                out_buf.clear();
+            }
+
+            out_buf.emplace_back(kv);
+        };
+
+    while(true)
+    {
+        if(base_idx == base_buf_count && base_read < base_count)
+        {
+            base_buf_count = std::min(merge_buf_elem_count, base_count - base_read);
+            read_limiter.acquire(base_buf_count * sizeof(key_val_pair_t));
+            if(!input.read(reinterpret_cast<char*>(base_buf.data()), base_buf_count * sizeof(key_val_pair_t)))
+            {
+                std::cerr << "Error reading the partition files. Aborting.\n";
+                std::exit(EXIT_FAILURE);
+            }
+
+            base_read += base_buf_count;
+            base_idx = 0;
+        }
+
+        const bool base_left = (base_idx < base_buf_count);
+        if(!base_left && new_idx == elem_count)
+            break;
+
+        if(base_left && (new_idx == elem_count || !(p_data[new_idx] < base_buf[base_idx])))
+            emit(base_buf[base_idx++]);
+        else
+            emit(p_data[new_idx++]);
+    }
+
+    if(rewrite)
+    {
+        write_limiter.acquire(out_buf.size() * sizeof(key_val_pair_t));
+        write_at(fd, out_buf.data(), out_buf.size() * sizeof(key_val_pair_t), out_off);
+    }
+
+    result.pair_count += (aggregate ? base_count + elem_count : 0);
+    input.close();
+
+    if(rewrite)
+    {
+        if(output_fd >= 0)  // The collated partition has moved into the single output file.
+            std::remove(p_path.c_str());
+        else if(close(fd) != 0 || std::rename(tmp_path.c_str(), p_path.c_str()) != 0)
+        {
+            std::cerr << "Error writing to the partition files. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    return base_count + elem_count;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline std::size_t Key_Value_Collator<T_key_, T_val_, T_hasher_>::collate_split_partition(const std::size_t p_id, key_val_pair_t* const p_data, const bool aggregate, Aggregate_Result& result)
+{
+    const std::size_t run_elem_count = split_run_bytes(p_id) / sizeof(key_val_pair_t);
+    std::vector<std::string> run_path;  // Paths to the sorted runs on disk: the child runs', then the pre-split ones'.
+    std::vector<std::size_t> run_size;  // Pair-counts of the sorted runs on disk.
+
+    const auto write_run = [&](const key_val_pair_t* const data, const std::size_t count)
+        {
+            run_path.emplace_back(split_file_path(p_id, run_path.size()) + ".sorted");
+            run_size.emplace_back(count);
+
+            std::ofstream output(run_path.back().c_str(), std::ios::out | std::ios::binary);
+            write_limiter.acquire(count * sizeof(key_val_pair_t));
+            if(!output.write(reinterpret_cast<const char*>(data), count * sizeof(key_val_pair_t)))
+            {
+                std::cerr << "Error writing to the partition files. Aborting.\n";
+                std::exit(EXIT_FAILURE);
+            }
+        };
+
+
+    // Sort each child run independently, as the child runs are disjoint in their keys.
+    for(std::size_t c_id = 0; c_id < split_fanout; ++c_id)
+    {
+        const std::string c_path = split_file_path(p_id, c_id);
+        const auto bytes = file_size(c_path);
+        if(bytes > 0)
+        {
+            std::ifstream input(c_path.c_str(), std::ios::in | std::ios::binary);
+            read_limiter.acquire(bytes);
+            if(!input.read(reinterpret_cast<char*>(p_data), bytes))
+            {
+                std::cerr << "Error reading the partition files. Aborting.\n";
+                std::exit(EXIT_FAILURE);
+            }
+        }
+
+        const std::size_t count = bytes / sizeof(key_val_pair_t);
+        std::sort(p_data, p_data + count);
+        write_run(p_data, count);
+
+        if(!checkpointing)  // Otherwise, the child run is kept until the collated partition is durable.
+            std::remove(c_path.c_str());
+    }
+
+
+    // Sort the pairs deposited before the split in runs of the memory at `p_data`, which is sized to hold them whole
+    // unless they exceed the split threshold. The last run is left in the memory to be merged from.
+    const std::vector<std::string> d_path = deposit_file_paths(p_id);
+    std::size_t mem_count = 0;  // Pair-count of the pre-split run in the memory.
+    for(const auto& path : d_path)
+    {
+        const std::size_t pre_count = file_size(path) / sizeof(key_val_pair_t);
+        std::ifstream input(path.c_str(), std::ios::in | std::ios::binary);
+        for(std::size_t read = 0; read < pre_count; )
+        {
+            if(mem_count == run_elem_count)
+            {
+                std::sort(p_data, p_data + mem_count);
+                write_run(p_data, mem_count);
+                mem_count = 0;
+            }
+
+            const std::size_t count = std::min(run_elem_count - mem_count, pre_count - read);
+            read_limiter.acquire(count * sizeof(key_val_pair_t));
+            if(!input.read(reinterpret_cast<char*>(p_data + mem_count), count * sizeof(key_val_pair_t)))
+            {
+                std::cerr << "Error reading the partition files. Aborting.\n";
+                std::exit(EXIT_FAILURE);
+            }
+
+            read += count;
+            mem_count += count;
+        }
+    }
+
+    std::sort(p_data, p_data + mem_count);
+
+    if(!checkpointing)  // Otherwise, the deposits are kept until the collated partition is durable.
+        for(const auto& path : d_path)
+            std::remove(path.c_str());
+
+
+    // Merge the sorted runs into the partition, so that it is in the sorted order like the unsplit ones. The runs on
+    // disk share the merge buffer memory.
+    const std::size_t disk_run_count = run_path.size();
+    const std::size_t run_buf_elem_count = std::max(merge_buf_elem_count / disk_run_count, min_run_buf_elem_count);
+    std::vector<std::ifstream> run_input;
+    std::vector<buf_t> run_buf(disk_run_count);
+    std::vector<const key_val_pair_t*> run_curr(disk_run_count + 1, nullptr);   // The next pair of each run, ...
+    std::vector<const key_val_pair_t*> run_end(disk_run_count + 1, nullptr);    // ... and the end of its buffered pairs.
+    std::vector<std::size_t> run_left(run_size);
+    for(const auto& path : run_path)
+        run_input.emplace_back(path.c_str(), std::ios::in | std::ios::binary);
+
+    run_curr[disk_run_count] = p_data;
+    run_end[disk_run_count] = p_data + mem_count;
+
+    const auto fill = [&](const std::size_t r_id)
+        {
+            run_buf[r_id].resize(std::min(run_buf_elem_count, run_left[r_id]));
+            read_limiter.acquire(run_buf[r_id].size() * sizeof(key_val_pair_t));
+            if(!run_input[r_id].read(reinterpret_cast<char*>(run_buf[r_id].data()), run_buf[r_id].size() * sizeof(key_val_pair_t)))
+            {
+                std::cerr << "Error reading the partition files. Aborting.\n";
+                std::exit(EXIT_FAILURE);
+            }
+
+            run_left[r_id] -= run_buf[r_id].size();
+            run_curr[r_id] = run_buf[r_id].data();
+            run_end[r_id] = run_curr[r_id] + run_buf[r_id].size();
+        };
+
+    for(std::size_t r_id = 0; r_id < disk_run_count; ++r_id)
+        fill(r_id);
+
+    Partition_Writer output(*this, p_id);
+    buf_t out_buf;
+    out_buf.reserve(merge_buf_elem_count);
+    T_key_ curr_key{};
+    std::size_t curr_key_freq = 0;
+    std::size_t elem_count = 0;
+    while(true)
+    {
+        std::size_t min_id = run_curr.size();
+        for(std::size_t r_id = 0; r_id < run_curr.size(); ++r_id)
+            if(run_curr[r_id] != run_end[r_id] && (min_id == run_curr.size() || *run_curr[r_id] < *run_curr[min_id]))
+                min_id = r_id;
+
+        if(min_id == run_curr.size())
+            break;
+
+        const key_val_pair_t kv = *run_curr[min_id]++;
+        if(run_curr[min_id] == run_end[min_id] && min_id < disk_run_count && run_left[min_id] > 0)
+            fill(min_id);
+
+        if(aggregate)
+        {
+            if(curr_key_freq == 0 || kv.first != curr_key)
+            {
+                curr_key = kv.first;
+                curr_key_freq = 0;
+                result.unique_key_count++;
+            }
+
+            if(result.mode_count < ++curr_key_freq)
+                result.mode_count = curr_key_freq;
+        }
+
+        out_buf.emplace_back(kv);
+        elem_count++;
+        if(out_buf.size() == merge_buf_elem_count)
+        {
+            output.write(out_buf.data(), out_buf.size());
+            out_buf.clear();
+        }
+    }
+
+    output.write(out_buf.data(), out_buf.size());
+    output.close(checkpointing);
+    run_input.clear();
+
+    result.pair_count += (aggregate ? elem_count : 0);
+
+    if(checkpointing)
+        checkpoint_partition(p_id, elem_count, result);
+
+    finish_split_partition(p_id, output_format == Output_Format::pairs && output_fd < 0);
+
+    return elem_count;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::finish_split_partition(const std::size_t p_id, const bool in_place)
+{
+    const std::string p_path = partition_file_path(p_id);
+    const std::string d_path = deposit_file_path(p_id);
+    const std::string tmp_path = p_path + ".tmp";
+    if(!in_place || d_path != p_path)   // The deposits before the split, kept till now.
+        std::remove(d_path.c_str());
+
+    if(in_place && access(tmp_path.c_str(), F_OK) == 0)
+    {
+        if(std::rename(tmp_path.c_str(), p_path.c_str()) != 0)
+        {
+            std::cerr << "Error writing to the partition files. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        if(checkpointing)
+            sync_parent_dir(p_path);
+    }
+
+    // The sorted runs of the pairs deposited before the split follow the child runs', as many as there were.
+    std::vector<std::string> run_path;
+    for(std::size_t c_id = 0; c_id < split_fanout; ++c_id)
+    {
+        run_path.emplace_back(split_file_path(p_id, c_id));
+        run_path.emplace_back(run_path.back() + ".sorted");
+    }
+
+    for(std::size_t r_id = split_fanout; access((split_file_path(p_id, r_id) + ".sorted").c_str(), F_OK) == 0; ++r_id)
+        run_path.emplace_back(split_file_path(p_id, r_id) + ".sorted");
+
+    Work_File_Remover::remove_files(run_path);
+    partition_split[p_id] = 0;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline const std::string Key_Value_Collator<T_key_, T_val_, T_hasher_>::run_file_path(const std::size_t p_id) const
+{
+    return partition_pref(p_id) + "." + std::to_string(p_id) + run_file_ext;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline const std::string Key_Value_Collator<T_key_, T_val_, T_hasher_>::split_file_path(const std::size_t p_id, const std::size_t c_id) const
+{
+    return stripe_pref[p_id % stripe_pref.size()] + "." + std::to_string(p_id) + "." + std::to_string(c_id) + split_file_ext;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline const std::string Key_Value_Collator<T_key_, T_val_, T_hasher_>::dataset_file_path(const std::size_t p_id, const std::string& manifest_id) const
+{
+    return collated_pref(p_id) + "." + std::to_string(p_id) + "." + manifest_id + dataset_file_ext;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline const std::string Key_Value_Collator<T_key_, T_val_, T_hasher_>::grouped_file_path(const std::size_t p_id, const char* const ext) const
+{
+    return collated_pref(p_id) + "." + std::to_string(p_id) + ext;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline Key_Value_Iterator<T_key_, T_val_> Key_Value_Collator<T_key_, T_val_, T_hasher_>::begin() const
+{
+    if(output_format != Output_Format::pairs)
+    {
+        std::cerr << "Key-value iterators require a collation in the pairs format. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    if(layout == nullptr)   // Iterate over the deposited pairs as they are.
+    {
+        if(std::find(partition_split.begin(), partition_split.end(), 1) != partition_split.end() ||
+           std::find(partition_overflow.begin(), partition_overflow.end(), 1) != partition_overflow.end() || exchange_count > 1)
+        {
+            std::cerr << "Deposits of split, overflowed, or exchanged partitions can only be iterated over once collated. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        std::vector<std::size_t> p_pair_count(partition_count);
+        for(std::size_t p_id = 0; p_id < partition_count; ++p_id)
+            p_pair_count[p_id] = partition_pair_count(p_id) - tail_count[p_id];
+
+        return iter_t(make_layout(p_pair_count, true));
+    }
+
+    return iter_t(layout);
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline Key_Value_Iterator<T_key_, T_val_> Key_Value_Collator<T_key_, T_val_, T_hasher_>::end() const
+{
+    return iter_t(layout != nullptr ? layout : make_layout(std::vector<std::size_t>(partition_count, 0), true), true);
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+const char Key_Value_Collator<T_key_, T_val_, T_hasher_>::partition_file_ext[];
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+const char Key_Value_Collator<T_key_, T_val_, T_hasher_>::dataset_file_ext[];
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+const char Key_Value_Collator<T_key_, T_val_, T_hasher_>::tail_file_ext[];
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+const char Key_Value_Collator<T_key_, T_val_, T_hasher_>::run_file_ext[];
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+const char Key_Value_Collator<T_key_, T_val_, T_hasher_>::split_file_ext[];
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+const char Key_Value_Collator<T_key_, T_val_, T_hasher_>::exchange_file_ext[];
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+const char Key_Value_Collator<T_key_, T_val_, T_hasher_>::key_file_ext[];
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+const char Key_Value_Collator<T_key_, T_val_, T_hasher_>::offset_file_ext[];
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+const char Key_Value_Collator<T_key_, T_val_, T_hasher_>::val_file_ext[];
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+const char Key_Value_Collator<T_key_, T_val_, T_hasher_>::checkpoint_file_ext[];
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+const std::size_t Key_Value_Collator<T_key_, T_val_, T_hasher_>::merge_buf_elem_count;
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+const std::size_t Key_Value_Collator<T_key_, T_val_, T_hasher_>::min_run_buf_elem_count;
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+const int Key_Value_Collator<T_key_, T_val_, T_hasher_>::io_prio_class_shift;
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+const std::size_t Key_Value_Collator<T_key_, T_val_, T_hasher_>::exchange_timeout_sec;
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+const std::size_t Key_Value_Collator<T_key_, T_val_, T_hasher_>::shared_channel_timeout_sec;
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+const std::size_t Key_Value_Collator<T_key_, T_val_, T_hasher_>::slab_buf_count;
+
+
+// A class to pack aggregation results from `Key_Value_Collator`.
+template <typename T_key_, typename T_val_, typename T_hasher_>
+class Key_Value_Collator<T_key_, T_val_, T_hasher_>::Aggregate_Result
+{
+    friend class Key_Value_Collator<T_key_, T_val_, T_hasher_>;
+
+private:
+
+    std::size_t unique_key_count;  // Number of unique keys.
+    std::size_t pair_count;        // Total number of key-value pairs.
+    std::size_t mode_count;        // Number of pairs with a most frequent key.
+
+
+    Aggregate_Result(): unique_key_count(0), pair_count(0), mode_count(0)
+    {}
+
+
+public:
 
     // Aggregates the result statistics with `other`'s ones.
     void aggregate(const Aggregate_Result& other)
@@ -564,6 +3456,350 @@ public:
 };
 
 
+// A writer of a collated partition of `Key_Value_Collator` in the output format
+// of its collation, fed with the sorted pairs of the partition in order. In the
+// pairs format, the partition is written into the single output file if any,
+// and otherwise into a temporary file beside the partition file, to be moved
+// into its place once complete.
+template <typename T_key_, typename T_val_, typename T_hasher_>
+class Key_Value_Collator<T_key_, T_val_, T_hasher_>::Partition_Writer
+{
+private:
+
+    Key_Value_Collator& collator; // The collator of the partition.
+    const std::size_t p_id; // ID of the partition.
+    const bool grouped; // Whether the partition is written in the grouped format.
+
+    int fd; // File-descriptor of the file the pairs are written into.
+    off_t offset;   // Byte-offset into the file of the next pair to be written.
+
+    // The arrays of the grouped format are staged through small buffers, to avoid materializing them in full.
+    static constexpr std::size_t stage_sz = 64 * 1024;
+    std::ofstream key_output, offset_output, val_output;
+    std::vector<T_key_> key_buf;
+    std::vector<std::size_t> offset_buf;
+    std::vector<T_val_> val_buf;
+    std::size_t pair_count; // Number of pairs written.
+    T_key_ last_key;    // The key of the last pair written.
+
+
+    // Writes out the staged array `buf` to `output`, and clears it.
+    template <typename T_buf_>
+    static void write_buf(std::ofstream& output, T_buf_& buf);
+
+
+public:
+
+    // Constructs a writer of the partition `p_id` of the collation by
+    // `collator`.
+    Partition_Writer(Key_Value_Collator& collator, std::size_t p_id);
+
+    // Writes the `count` pairs at `data`, following the ones written earlier.
+    void write(const key_val_pair_t* data, std::size_t count);
+
+    // Completes the partition, and flushes it to the storage device iff
+    // `durable` is `true`.
+    void close(bool durable);
+};
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline Key_Value_Collator<T_key_, T_val_, T_hasher_>::Partition_Writer::Partition_Writer(Key_Value_Collator& collator, const std::size_t p_id):
+    collator(collator),
+    p_id(p_id),
+    grouped(collator.output_format == Output_Format::grouped),
+    fd(-1),
+    offset(0),
+    pair_count(0),
+    last_key()
+{
+    if(grouped)
+    {
+        key_output.open(collator.grouped_file_path(p_id, key_file_ext).c_str(), std::ios::out | std::ios::binary);
+        offset_output.open(collator.grouped_file_path(p_id, offset_file_ext).c_str(), std::ios::out | std::ios::binary);
+        val_output.open(collator.grouped_file_path(p_id, val_file_ext).c_str(), std::ios::out | std::ios::binary);
+        key_buf.reserve(stage_sz);
+        offset_buf.reserve(stage_sz);
+        val_buf.reserve(stage_sz);
+    }
+    else if(collator.output_fd >= 0)
+    {
+        fd = collator.output_fd;
+        offset = collator.output_file_offset[p_id];
+    }
+    else
+    {
+        fd = open((collator.partition_file_path(p_id) + ".tmp").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0)
+        {
+            std::cerr << "Error writing to the partition files. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+    }
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+template <typename T_buf_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::Partition_Writer::write_buf(std::ofstream& output, T_buf_& buf)
+{
+    if(!output.write(reinterpret_cast<const char*>(buf.data()), buf.size() * sizeof(buf[0])))
+    {
+        std::cerr << "Error writing to the partition files. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    buf.clear();
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::Partition_Writer::write(const key_val_pair_t* const data, const std::size_t count)
+{
+    collator.write_limiter.acquire(count * sizeof(key_val_pair_t));
+
+    if(!grouped)
+    {
+        write_at(fd, data, count * sizeof(key_val_pair_t), offset);
+        offset += count * sizeof(key_val_pair_t);
+        return;
+    }
+
+    for(std::size_t i = 0; i < count; ++i, ++pair_count)
+    {
+        if(pair_count == 0 || data[i].first != last_key)
+        {
+            last_key = data[i].first;
+            key_buf.emplace_back(last_key);
+            offset_buf.emplace_back(pair_count);
+            if(key_buf.size() == stage_sz)
+            {
+                write_buf(key_output, key_buf);
+                write_buf(offset_output, offset_buf);
+            }
+        }
+
+        val_buf.emplace_back(data[i].second);
+        if(val_buf.size() == stage_sz)
+            write_buf(val_output, val_buf);
+    }
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::Partition_Writer::close(const bool durable)
+{
+    if(grouped)
+    {
+        offset_buf.emplace_back(pair_count);
+        write_buf(key_output, key_buf);
+        write_buf(offset_output, offset_buf);
+        write_buf(val_output, val_buf);
+        key_output.close();
+        offset_output.close();
+        val_output.close();
+
+        if(durable)
+        {
+            sync_file(collator.grouped_file_path(p_id, key_file_ext));
+            sync_file(collator.grouped_file_path(p_id, offset_file_ext));
+            sync_file(collator.grouped_file_path(p_id, val_file_ext));
+            sync_parent_dir(collator.grouped_file_path(p_id, key_file_ext));
+        }
+
+        for(const char* const ext : {key_file_ext, offset_file_ext, val_file_ext})
+            collator.drop_pages(collator.grouped_file_path(p_id, ext));
+
+        return;
+    }
+
+    if(durable && fdatasync(fd) != 0)
+    {
+        std::cerr << "Error writing to the partition files. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    if(fd == collator.output_fd)
+        collator.drop_pages(fd, collator.output_file_offset[p_id], offset - collator.output_file_offset[p_id]);
+    else
+        collator.drop_pages(fd);
+
+    if(fd != collator.output_fd && ::close(fd) != 0)
+    {
+        std::cerr << "Error writing to the partition files. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+
+// A writer of the spilled partition buffers of `Key_Value_Collator` into the
+// files of a work directory, in the background; so that the spills into
+// different storage devices proceed in parallel, and with the mapping of the
+// deposits. The buffers of each spill stream are written in order.
+template <typename T_key_, typename T_val_, typename T_hasher_>
+class Key_Value_Collator<T_key_, T_val_, T_hasher_>::Spill_Writer
+{
+private:
+
+    Key_Value_Collator& collator;   // The collator of the spills.
+
+    struct Spill
+    {
+        std::size_t s_id;   // ID of the spill stream.
+        std::string path;   // Path of the file the buffer is to be appended to.
+        key_val_pair_t* buf;    // The partition buffer.
+        std::size_t count;  // Number of pairs in the buffer.
+        bool reopen;    // Whether the stream moves to the file at `path`, in another spill tier, from this buffer on.
+    };
+
+    static constexpr std::size_t max_pending = slab_buf_count;  // Maximum number of buffers pending to be written.
+    std::deque<Spill> queue;    // The buffers queued to be written.
+    std::size_t pending;    // Number of buffers queued or being written.
+    bool stop;  // Whether the writer is to exit.
+
+    std::mutex mtx; // Mutex for the queue.
+    std::condition_variable cv; // Notifies the arrival and the completion of the writes.
+    std::thread worker; // The background thread writing the buffers.
+
+
+    // Writes the queued buffers, until stopped.
+    void run();
+
+
+public:
+
+    // Constructs a spill writer for the collator `collator`.
+    explicit Spill_Writer(Key_Value_Collator& collator);
+
+    ~Spill_Writer();
+
+    // Queues the `count` pairs in the partition buffer `buf` of the spill
+    // stream `s_id` to be appended to the file at `path`, moving the stream
+    // to that file first iff `reopen`; the buffer is returned to the collator
+    // once written. Waits while too many buffers are pending.
+    void submit(std::size_t s_id, std::string path, key_val_pair_t* buf, std::size_t count, bool reopen = false);
+
+    // Waits until all the queued buffers are written.
+    void drain();
+};
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline Key_Value_Collator<T_key_, T_val_, T_hasher_>::Spill_Writer::Spill_Writer(Key_Value_Collator& collator):
+    collator(collator),
+    pending(0),
+    stop(false),
+    worker(&Spill_Writer::run, this)
+{}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline Key_Value_Collator<T_key_, T_val_, T_hasher_>::Spill_Writer::~Spill_Writer()
+{
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        stop = true;
+    }
+
+    cv.notify_all();
+    worker.join();
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::Spill_Writer::run()
+{
+    std::vector<Spill> batch;
+    std::vector<iovec> iov;
+    int prio = -1;  // None applied yet, as the thread may have inherited a priority of its creator.
+    std::unique_lock<std::mutex> guard(mtx);
+    while(true)
+    {
+        cv.wait(guard, [this]{ return stop || !queue.empty(); });
+        if(queue.empty())
+            return;
+
+        // All the queued buffers are taken at once, and the ones of a stream are written with a single vectored
+        // write, in the order of the streams.
+        batch.assign(std::make_move_iterator(queue.begin()), std::make_move_iterator(queue.end()));
+        queue.clear();
+        guard.unlock();
+
+        const int curr_prio = collator.io_prio; // May be set after the writer started.
+        if(curr_prio != prio)
+        {
+            // Validated by `set_io_priority`; were it refused still, the writer would go on at its priority.
+            prio = curr_prio;
+            apply_io_priority(prio);
+        }
+
+        std::stable_sort(batch.begin(), batch.end(), [](const Spill& lhs, const Spill& rhs){ return lhs.s_id < rhs.s_id; });
+        for(std::size_t i = 0, j; i < batch.size(); i = j)
+        {
+            const std::size_t s_id = batch[i].s_id;
+            int& fd = collator.partition_fd[s_id];
+            if(batch[i].reopen && fd >= 0)
+            {
+                close(fd);
+                fd = -1;
+            }
+
+            // A stream is truncated at its first file only; the file it moves to keeps anything there.
+            if(fd < 0)
+            {
+                fd = open(batch[i].path.c_str(), O_WRONLY | O_CREAT | (batch[i].reopen ? O_APPEND : O_TRUNC), 0644);
+                if(fd < 0)
+                {
+                    std::cerr << "Error opening partition file(s) of the collator. Aborting.\n";
+                    std::exit(EXIT_FAILURE);
+                }
+            }
+
+            // A reopen splits the buffers of a stream, as the ones after it go to another file.
+            iov.clear();
+            for(j = i; j < batch.size() && batch[j].s_id == s_id && (j == i || !batch[j].reopen); ++j)
+                iov.push_back(iovec{batch[j].buf, batch[j].count * sizeof(key_val_pair_t)});
+
+            std::size_t bytes = 0;
+            for(const iovec& v : iov)
+                bytes += v.iov_len;
+
+            collator.write_limiter.acquire(bytes);
+            write_vec(fd, iov.data(), iov.size());
+            collator.drop_pages(fd);
+            for(std::size_t k = i; k < j; ++k)
+                collator.return_partition_buf(batch[k].buf);
+        }
+
+        guard.lock();
+        pending -= batch.size();
+        cv.notify_all();
+    }
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::Spill_Writer::submit(const std::size_t s_id, std::string path, key_val_pair_t* const buf, const std::size_t count, const bool reopen)
+{
+    {
+        std::unique_lock<std::mutex> guard(mtx);
+        cv.wait(guard, [this]{ return pending < max_pending; });
+        queue.push_back(Spill{s_id, std::move(path), buf, count, reopen});
+        pending++;
+    }
+
+    cv.notify_all();
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Collator<T_key_, T_val_, T_hasher_>::Spill_Writer::drain()
+{
+    std::unique_lock<std::mutex> guard(mtx);
+    cv.wait(guard, [this]{ return pending == 0; });
+}
+
+
 template <typename T_key_>
 class Identity_Functor
 {
@@ -0,0 +1,161 @@
+
+#ifndef KEY_VALUE_DATASET_HPP
+#define KEY_VALUE_DATASET_HPP
+
+
+
+#include "Collation_Layout.hpp"
+#include "Key_Value_Iterator.hpp"
+#include "Key_Value_Merge_Iterator.hpp"
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+
+// =============================================================================
+
+namespace key_value_collator
+{
+
+
+// A read-only handle to a collation of key-value pairs of type
+// `(T_key_, T_val_)` that outlives its `Key_Value_Collator`: either a single
+// file exported with `collate_to_file`, or a manifest written with `persist`.
+// Opening it reads only the header and the partition directory, and the
+// collation is read in with the same iterators and readers as the collator's.
+template <typename T_key_, typename T_val_>
+class Key_Value_Dataset
+{
+public:
+
+    typedef Key_Value_Iterator<T_key_, T_val_> iter_t;  // Type of the iterator over the dataset.
+    typedef Key_Value_Merge_Iterator<T_key_, T_val_> ordered_iter_t;    // Type of the globally key-ordered iterator over the dataset.
+
+
+private:
+
+    Collation_File_Header header;   // Header of the dataset's file.
+    std::shared_ptr<const Collation_Layout> layout; // Layout of the collated partitions on disk.
+
+
+public:
+
+    // Opens the persisted collation at path `file_path`: a single-file
+    // collation, or a manifest of one.
+    explicit Key_Value_Dataset(const std::string& file_path);
+
+    // Returns the number of partitions.
+    std::size_t partition_count() const { return header.partition_count; }
+
+    // Returns the number of key-value pairs.
+    std::size_t pair_count() const { return header.pair_count; }
+
+    // Returns whether the aggregates of the collation had been computed.
+    bool aggregated() const { return header.aggregated != 0; }
+
+    std::size_t unique_key_count() const { return header.unique_key_count; }    // Returns the number of unique keys.
+
+    std::size_t mode_frequency() const { return header.mode_count; }    // Returns the number of pairs with a most frequent key.
+
+    // Returns whether the keys of the collation were partitioned with the
+    // hasher type `T_hasher_`.
+    template <typename T_hasher_>
+    bool hashed_with() const { return header.hasher_type_id == type_id<T_hasher_>(); }
+
+    // Returns the on-disk layout of the collation, for its readers, e.g. the
+    // batch reader and the shared scan.
+    std::shared_ptr<const Collation_Layout> collation_layout() const { return layout; }
+
+    // Returns an iterator pointing to the beginning of the dataset.
+    iter_t begin() const { return iter_t(layout); }
+
+    // Returns an iterator pointing to the ending (exclusive) of the dataset.
+    iter_t end() const { return iter_t(layout, true); }
+
+    // Returns an iterator over the dataset in the global order of the keys.
+    ordered_iter_t ordered_begin() const { return ordered_iter_t(layout); }
+
+    // Returns an iterator pointing to the ending (exclusive) of the dataset in
+    // the global order of the keys.
+    ordered_iter_t ordered_end() const { return ordered_iter_t(layout, true); }
+};
+
+
+template <typename T_key_, typename T_val_>
+inline Key_Value_Dataset<T_key_, T_val_>::Key_Value_Dataset(const std::string& file_path)
+{
+    std::ifstream input(file_path.c_str(), std::ios::in | std::ios::binary);
+    if(!input.read(reinterpret_cast<char*>(&header), sizeof(header)))
+    {
+        std::cerr << "Error reading the dataset header. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    if(std::memcmp(header.magic, collation_file_magic, sizeof(header.magic)) != 0 || header.version != collation_file_version)
+    {
+        std::cerr << "Unrecognized dataset format. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    if(header.key_size != sizeof(T_key_) || header.val_size != sizeof(T_val_) || header.pair_size != sizeof(std::pair<T_key_, T_val_>) ||
+       header.key_type_id != type_id<T_key_>() || header.val_type_id != type_id<T_val_>())
+    {
+        std::cerr << "Dataset key-value types mismatch the requested ones. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::vector<Collation_File_Dir_Entry> dir(header.partition_count);
+    std::string path_table(header.path_table_size, '\0');
+    if(!input.read(reinterpret_cast<char*>(dir.data()), dir.size() * sizeof(Collation_File_Dir_Entry)) ||
+       !input.read(&path_table[0], path_table.size()))
+    {
+        std::cerr << "Error reading the dataset directory. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    auto l = std::make_shared<Collation_Layout>();
+    l->path.reserve(header.partition_count);
+    l->file_offset.reserve(header.partition_count);
+    l->pair_offset.resize(header.partition_count + 1, 0);
+    for(std::size_t p_id = 0, path_pos = 0; p_id < header.partition_count; ++p_id)
+    {
+        if(header.path_table_size == 0)
+            l->path.push_back(file_path);
+        else
+        {
+            if(path_pos >= path_table.size())
+            {
+                std::cerr << "Malformed path table in the dataset manifest. Aborting.\n";
+                std::exit(EXIT_FAILURE);
+            }
+
+            l->path.emplace_back(path_table.c_str() + path_pos);
+            path_pos += l->path.back().size() + 1;
+        }
+
+        l->file_offset.push_back(dir[p_id].offset);
+        l->pair_offset[p_id + 1] = l->pair_offset[p_id] + dir[p_id].pair_count;
+    }
+
+    if(l->pair_count() != header.pair_count)
+    {
+        std::cerr << "Inconsistent partition directory in the dataset. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    layout = std::move(l);
+}
+
+}
+
+
+
+#endif
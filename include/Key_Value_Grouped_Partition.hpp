@@ -0,0 +1,158 @@
+
+#ifndef KEY_VALUE_GROUPED_PARTITION_HPP
+#define KEY_VALUE_GROUPED_PARTITION_HPP
+
+
+
+#include <cstddef>
+#include <string>
+#include <cstdlib>
+#include <cerrno>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+// =============================================================================
+
+namespace key_value_collator
+{
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_> class Key_Value_Collator;
+
+
+// A read-only view of a partition collated by the class `Key_Value_Collator`
+// in the grouped (CSR) format, with keys of type `T_key_` and values of type
+// `T_val_`. The values of the `i`'th unique key `keys()[i]` are at
+// `values()[offsets()[i]]` to `values()[offsets()[i + 1] - 1]`. The arrays are
+// memory-mapped from the partition files.
+template <typename T_key_, typename T_val_>
+class Key_Value_Grouped_Partition
+{
+private:
+
+    const T_key_* key;  // The sorted unique keys.
+    std::size_t key_count_; // Number of unique keys.
+    const std::size_t* offset;  // The offsets of the keys' values; has `key_count_ + 1` entries.
+    std::size_t offset_count;   // Number of entries in the offsets array.
+    const T_val_* val;  // The values, grouped by their keys.
+    std::size_t val_count;  // Number of values.
+
+
+    // Maps the file at path `file_path` to memory as an array of `T_`, and
+    // sets `count` to its element-count. Returns null for an empty or a missing file.
+    template <typename T_>
+    static const T_* map_file(const std::string& file_path, std::size_t& count);
+
+    // Unmaps the array `arr` of `count` elements of `T_`, if mapped.
+    template <typename T_>
+    static void unmap(const T_* arr, std::size_t count);
+
+
+public:
+
+    Key_Value_Grouped_Partition(const Key_Value_Grouped_Partition&) = delete;
+    Key_Value_Grouped_Partition& operator=(const Key_Value_Grouped_Partition&) = delete;
+
+    // Constructs a view of the partition with ID `p_id` of the grouped
+    // collation of `collator`.
+    template <typename T_hasher_>
+    Key_Value_Grouped_Partition(const Key_Value_Collator<T_key_, T_val_, T_hasher_>& collator, std::size_t p_id);
+
+    ~Key_Value_Grouped_Partition();
+
+    // Returns the number of unique keys in the partition.
+    std::size_t key_count() const { return key_count_; }
+
+    // Returns the number of key-value pairs in the partition.
+    std::size_t pair_count() const { return val_count; }
+
+    // Returns the array of the sorted unique keys.
+    const T_key_* keys() const { return key; }
+
+    // Returns the array of the value-offsets of the keys.
+    const std::size_t* offsets() const { return offset; }
+
+    // Returns the array of the values.
+    const T_val_* values() const { return val; }
+};
+
+
+template <typename T_key_, typename T_val_>
+template <typename T_hasher_>
+inline Key_Value_Grouped_Partition<T_key_, T_val_>::Key_Value_Grouped_Partition(const Key_Value_Collator<T_key_, T_val_, T_hasher_>& collator, const std::size_t p_id)
+{
+    typedef Key_Value_Collator<T_key_, T_val_, T_hasher_> collator_t;
+    if(collator.output_format != collator_t::Output_Format::grouped)
+    {
+        std::cerr << "Grouped partitions require a collation in the grouped format. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    key = map_file<T_key_>(collator.grouped_file_path(p_id, collator_t::key_file_ext), key_count_);
+    offset = map_file<std::size_t>(collator.grouped_file_path(p_id, collator_t::offset_file_ext), offset_count);
+    val = map_file<T_val_>(collator.grouped_file_path(p_id, collator_t::val_file_ext), val_count);
+}
+
+
+template <typename T_key_, typename T_val_>
+inline Key_Value_Grouped_Partition<T_key_, T_val_>::~Key_Value_Grouped_Partition()
+{
+    unmap(key, key_count_);
+    unmap(offset, offset_count);
+    unmap(val, val_count);
+}
+
+
+template <typename T_key_, typename T_val_>
+template <typename T_>
+inline const T_* Key_Value_Grouped_Partition<T_key_, T_val_>::map_file(const std::string& file_path, std::size_t& count)
+{
+    const int fd = open(file_path.c_str(), O_RDONLY);
+    if(fd < 0 && errno == ENOENT)   // Empty partitions have no files.
+    {
+        count = 0;
+        return nullptr;
+    }
+
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0)
+    {
+        std::cerr << "Error opening grouped partition files. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    count = st.st_size / sizeof(T_);
+    void* arr = nullptr;
+    if(count > 0)
+    {
+        arr = mmap(nullptr, count * sizeof(T_), PROT_READ, MAP_SHARED, fd, 0);
+        if(arr == MAP_FAILED)
+        {
+            std::cerr << "Error mapping grouped partition files. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    close(fd);
+
+    return static_cast<const T_*>(arr);
+}
+
+
+template <typename T_key_, typename T_val_>
+template <typename T_>
+inline void Key_Value_Grouped_Partition<T_key_, T_val_>::unmap(const T_* const arr, const std::size_t count)
+{
+    if(arr != nullptr)
+        munmap(const_cast<T_*>(arr), count * sizeof(T_));
+}
+
+}
+
+
+
+#endif
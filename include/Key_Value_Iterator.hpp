@@ -5,13 +5,21 @@
 
 
 #include "Spin_Lock.hpp"
+#include "Collation_Layout.hpp"
 
 #include <cstddef>
 #include <string>
+#include <vector>
+#include <memory>
 #include <utility>
 #include <cstdlib>
 #include <cstdio>
 #include <iostream>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fcntl.h>
 
 
 // =============================================================================
@@ -31,40 +39,92 @@ class Key_Value_Iterator
 
 private:
 
-    const std::string work_pref;    // Path to the working files used by the collator.
+    const std::shared_ptr<const Collation_Layout> layout;   // Layout of the collated partitions on disk.
     const std::size_t partition_count;  // Number of partitions used by the collator.
 
-    std::FILE* file_ptr;    // Pointer to the current (collated) partition file.
-    std::size_t curr_p_id;  // ID of the current partition being iterated over.
+    std::FILE* file_ptr;    // Pointer to the current (collated) partition file being read from.
+    std::FILE* next_file_ptr;   // Pointer to the file of the non-empty partition next to the current one, opened in advance.
+    std::size_t curr_p_id;  // ID of the current partition being read from.
+    std::size_t next_p_id;  // ID of the partition of `next_file_ptr`.
+    std::size_t p_remaining;    // Number of pairs of the current partition yet to be read.
 
-    std::size_t pos;    // Absolute index (sequential ID of the key-block) into the collated collection.
+    std::size_t pos;    // Absolute index of the next pair to process in the collated collection.
     bool at_end;    // Whether the iterator is at the end of the collection.
 
     static constexpr std::size_t buf_sz = 5lu * 1024lu * 1024lu / sizeof(key_val_pair_t);   // Size of the buffer in elements: total 5MB.
     key_val_pair_t* buf;    // Buffer to read in chunks of key-value pairs.
+    key_val_pair_t* buf_ahead;  // Buffer being filled asynchronously with the chunk of pairs following `buf`.
     std::size_t buf_elem_count; // Number of pairs currently in the buffer.
     std::size_t buf_idx;    // Index of the next pair to process from the buffer.
 
+    std::thread reader; // The readahead thread, started at the first readahead; fills `buf_ahead` on request.
+    std::mutex read_mtx;    // Mutex for the readahead requests.
+    std::condition_variable read_cv;    // Notifies the readahead requests and their completions.
+    bool read_requested;    // Whether a read into `buf_ahead` is requested and not completed yet.
+    bool read_pending;  // Whether a read into `buf_ahead` is issued and its chunk not taken yet.
+    bool reader_stop;   // Whether the readahead thread is to exit.
+    std::size_t read_ahead_count;   // Pair-count of the last completed read into `buf_ahead`.
+
     key_val_pair_t elem;    // Current pair to process.
+    bool has_elem;  // Whether `elem` holds the pair at the iterator's position, i.e. the one preceding `pos`.
 
     Spin_Lock lock; // Mutually-exclusive access lock for the iterator users.
 
 
-    // Constructs an iterator for a key-value collator that has its collated
-    // files at path prefix `work_pref` and used `partition_count` partitions.
-    Key_Value_Iterator(const std::string& work_pref, std::size_t partition_count, bool at_end = false);
+    // Opens the file of the partition with ID `p_id`, positioned at the
+    // partition's beginning.
+    std::FILE* open_partition(std::size_t p_id) const;
 
-    // Returns the disk-file path for the partition `p_id`.
-    // TODO: think management of codes repeated between collator and iterator.
-    const std::string partition_file_path(std::size_t p_id) const { return work_pref + "." + std::to_string(p_id) + ".part"; }
+    // Returns the ID of the first non-empty partition at or after `p_id`, or
+    // the partition-count if there is none.
+    std::size_t non_empty_partition(std::size_t p_id) const;
 
-    // Sets the file-handle to the file of the partition with ID `p_id`.
+    // Sets the file-handle to the file of the first non-empty partition at or
+    // after the one with ID `p_id`, and opens the next non-empty partition's
+    // file in advance with a readahead hint. Empty partitions may have no
+    // files. The file-handle is set to null if there is no such partition.
     void set_file_handle(std::size_t p_id);
 
-    // Advances in the collection by one key-value pair. Sets the current file-
-    // handle to null if the end of the collection has been reached.
+    // Allocates the buffers.
+    void allocate_buffers();
+
+    // Allocates the buffers, opens the first partition, and issues the first
+    // read.
+    void start();
+
+    // Reads in at most `count` key-value pairs into `dst` from the current
+    // partition, moving on to the next partitions if it is exhausted. Returns
+    // the number of pairs read, which is 0 iff the end of the collection has
+    // been reached. The read pairs never span more than one partition.
+    std::size_t fill(key_val_pair_t* dst, std::size_t count);
+
+    // Issues an asynchronous read of the next chunk of pairs into `buf_ahead`,
+    // to the readahead thread.
+    void read_ahead();
+
+    // Waits for the read issued into `buf_ahead`, if any, to complete, and
+    // returns its pair-count; 0 if there is none. The read is no longer
+    // pending afterwards.
+    std::size_t wait_read_ahead();
+
+    // Reads in the chunks requested into `buf_ahead`, until stopped.
+    void run_reader();
+
+    // Replaces the exhausted buffer with the chunk read ahead, and issues the
+    // next readahead. Returns `false` iff the end of the collection has been
+    // reached.
+    bool refill();
+
+    // Advances in the collection by one key-value pair. Sets `at_end` if the
+    // end of the collection has been reached.
     void advance();
 
+    // Returns a pointer to the first pair in the sorted range `[first, last)`
+    // that has a key different from `key`, where the range is sorted if it
+    // starts with pairs of key `key`. Gallops from `first` so that the cost is
+    // logarithmic in the length of the key-block rather than of the range.
+    static const key_val_pair_t* skip_key(const key_val_pair_t* first, const key_val_pair_t* last, const T_key_& key);
+
     // Advances in the collection by one key-block, i.e. passes by all the
     // pairs that have the same key as the current one.
     void advance_key_block();
@@ -72,10 +132,17 @@ private:
 
 public:
 
-    // Copy constructs an iterator from the iterator `other`. Only usable with
-    // `other` iterators that are unmodified results of `begin()` and `end()`.
+    // Copy constructs an iterator from the iterator `other`, positioned at the
+    // same pair as `other`. The copy has its own buffers and file-handles, and
+    // does not re-read the data preceding its position. Should not be invoked
+    // concurrently with `read()` on `other`.
     Key_Value_Iterator(const Key_Value_Iterator& other);
 
+    // Constructs an iterator for a key-value collection with the on-disk
+    // layout `layout`, at the beginning of the collection, or at its end iff
+    // `at_end` is `true`.
+    Key_Value_Iterator(std::shared_ptr<const Collation_Layout> layout, bool at_end = false);
+
     // Destructs the iterator.
     ~Key_Value_Iterator();
 
@@ -95,7 +162,16 @@ public:
 
     // Returns the absolute key-value pair index of the iterator's current
     // position.
-    std::size_t pair_index() const { return pos; }
+    std::size_t pair_index() const { return pos - has_elem; }
+
+    // Positions the iterator at the key-value pair with absolute index `idx`,
+    // or at the end of the collection if `idx` is not less than the pair-
+    // count. Note that the position may be in the middle of a key-block.
+    void seek(std::size_t idx);
+
+    // Positions the iterator at the first key-value pair of the partition with
+    // ID `p_id`.
+    void seek_partition(std::size_t p_id);
 
     // Tries to read in at most `count` key-value pairs into `buf`. Returns the
     // number of pairs read, which is 0 in case when the end of the collection
@@ -105,35 +181,54 @@ public:
 
 
 template <typename T_key_, typename T_val_>
-inline Key_Value_Iterator<T_key_, T_val_>::Key_Value_Iterator(const std::string& work_pref, const std::size_t partition_count, const bool at_end):
-    work_pref(work_pref),
-    partition_count(partition_count),
+inline Key_Value_Iterator<T_key_, T_val_>::Key_Value_Iterator(std::shared_ptr<const Collation_Layout> layout, const bool at_end):
+    layout(std::move(layout)),
+    partition_count(this->layout->partition_count()),
     file_ptr(nullptr),
+    next_file_ptr(nullptr),
     curr_p_id(0),
+    next_p_id(0),
+    p_remaining(0),
     pos(0),
-    at_end(at_end),
+    at_end(at_end || this->layout->pair_count() == 0),
     buf(nullptr),
+    buf_ahead(nullptr),
     buf_elem_count(0),
-    buf_idx(0)
+    buf_idx(0),
+    read_requested(false),
+    read_pending(false),
+    reader_stop(false),
+    read_ahead_count(0),
+    has_elem(false)
 {}
 
 
 template <typename T_key_, typename T_val_>
 inline Key_Value_Iterator<T_key_, T_val_>::Key_Value_Iterator(const Key_Value_Iterator& other):
-    work_pref(other.work_pref),
+    layout(other.layout),
     partition_count(other.partition_count),
-    file_ptr(other.file_ptr),
-    curr_p_id(other.curr_p_id),
+    file_ptr(nullptr),
+    next_file_ptr(nullptr),
+    curr_p_id(0),
+    next_p_id(0),
+    p_remaining(0),
     pos(other.pos),
     at_end(other.at_end),
     buf(nullptr),
-    buf_elem_count(other.buf_elem_count),
-    buf_idx(other.buf_idx)
+    buf_ahead(nullptr),
+    buf_elem_count(0),
+    buf_idx(0),
+    read_requested(false),
+    read_pending(false),
+    reader_stop(false),
+    read_ahead_count(0),
+    has_elem(false)
 {
-    if(other.file_ptr != nullptr || other.buf != nullptr)
+    if(other.buf != nullptr && !other.at_end)   // `other` is in use; resume from its position.
     {
-        std::cerr << "Cannot copy key-value iterator that is in use. Aborting.\n";
-        std::exit(EXIT_FAILURE);
+        seek(other.pair_index());
+        if(other.has_elem)
+            advance();
     }
 }
 
@@ -141,17 +236,32 @@ inline Key_Value_Iterator<T_key_, T_val_>::Key_Value_Iterator(const Key_Value_It
 template <typename T_key_, typename T_val_>
 inline Key_Value_Iterator<T_key_, T_val_>::~Key_Value_Iterator()
 {
+    if(reader.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> guard(read_mtx);
+            reader_stop = true;
+        }
+
+        read_cv.notify_all();
+        reader.join();  // Completes the in-flight read first.
+    }
+
     if(file_ptr != nullptr)
         std::fclose(file_ptr);
 
+    if(next_file_ptr != nullptr)
+        std::fclose(next_file_ptr);
+
     std::free(buf);
+    std::free(buf_ahead);
 }
 
 
 template <typename T_key_, typename T_val_>
 inline T_key_ Key_Value_Iterator<T_key_, T_val_>::operator*()
 {
-    if(buf == nullptr)
+    if(!has_elem)
         advance();
 
     return elem.first;
@@ -171,10 +281,10 @@ inline Key_Value_Iterator<T_key_, T_val_>& Key_Value_Iterator<T_key_, T_val_>::o
 template <typename T_key_, typename T_val_>
 inline bool Key_Value_Iterator<T_key_, T_val_>::operator==(const Key_Value_Iterator& rhs) const
 {
-    if(file_ptr == nullptr || rhs.file_ptr == nullptr)
-        return file_ptr == nullptr && rhs.file_ptr == nullptr && at_end == rhs.at_end;
+    if(at_end || rhs.at_end)
+        return at_end == rhs.at_end;
 
-    return file_ptr == rhs.file_ptr && pos == rhs.pos;
+    return layout == rhs.layout && pair_index() == rhs.pair_index();
 }
 
 
@@ -196,81 +306,278 @@ inline std::size_t Key_Value_Iterator<T_key_, T_val_>::read(key_val_pair_t* cons
         return 0;
     }
 
-    if(file_ptr == nullptr && !at_end)
-        set_file_handle(0);
+    if(this->buf == nullptr)
+        start();
 
-    std::size_t buf_elem_count = 0;
-    while(buf_elem_count == 0)
+    std::size_t read_count = 0;
+    if(buf_idx < buf_elem_count || refill())
     {
-        buf_elem_count = (file_ptr != nullptr ?
-                            std::fread(static_cast<void*>(buf), sizeof(key_val_pair_t), count, file_ptr) : 0);
+        read_count = std::min(count, buf_elem_count - buf_idx);
+        std::copy(this->buf + buf_idx, this->buf + buf_idx + read_count, buf);
 
-        if(buf_elem_count == 0)
-        {
-            if(++curr_p_id == partition_count)
-            {
-                std::fclose(file_ptr);
+        buf_idx += read_count;
+        pos += read_count;
+    }
+
+    has_elem = false;
+
+    lock.unlock();
+
+    return read_count;
+}
 
-                file_ptr = nullptr;
-                at_end = true;
-                break;
-            }
 
-            set_file_handle(curr_p_id);
+template <typename T_key_, typename T_val_>
+inline void Key_Value_Iterator<T_key_, T_val_>::allocate_buffers()
+{
+    buf = static_cast<key_val_pair_t*>(std::malloc(buf_sz * sizeof(key_val_pair_t)));
+    buf_ahead = static_cast<key_val_pair_t*>(std::malloc(buf_sz * sizeof(key_val_pair_t)));
+    if(buf == nullptr || buf_ahead == nullptr)
+    {
+        std::cerr << "Error allocating buffers for key-value iterator. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+
+template <typename T_key_, typename T_val_>
+inline void Key_Value_Iterator<T_key_, T_val_>::start()
+{
+    allocate_buffers();
+    set_file_handle(0);
+    read_ahead();
+}
+
+
+template <typename T_key_, typename T_val_>
+inline void Key_Value_Iterator<T_key_, T_val_>::seek(const std::size_t idx)
+{
+    wait_read_ahead(); // The in-flight read uses the file-handles.
+
+    if(buf == nullptr)
+        allocate_buffers();
+
+    const std::vector<std::size_t>& offset = layout->pair_offset;
+    pos = std::min(idx, offset.back());
+    at_end = (pos == offset.back());
+    has_elem = false;
+    buf_elem_count = buf_idx = 0;
+
+    if(at_end)
+        return;
+
+    // The partition containing the pair is the last one starting at or before it.
+    const std::size_t p_id = std::upper_bound(offset.cbegin(), offset.cend(), pos) - offset.cbegin() - 1;
+    set_file_handle(p_id);
+    if(fseeko(file_ptr, (pos - offset[p_id]) * sizeof(key_val_pair_t), SEEK_CUR))
+    {
+        std::cerr << "Error seeking in partition files. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    p_remaining -= pos - offset[p_id];
+    read_ahead();
+}
+
+
+template <typename T_key_, typename T_val_>
+inline void Key_Value_Iterator<T_key_, T_val_>::seek_partition(const std::size_t p_id)
+{
+    seek(p_id < partition_count ? layout->pair_offset[p_id] : layout->pair_count());
+}
+
+
+template <typename T_key_, typename T_val_>
+inline std::size_t Key_Value_Iterator<T_key_, T_val_>::fill(key_val_pair_t* const dst, const std::size_t count)
+{
+    while(file_ptr != nullptr)
+    {
+        // A partition may be followed by other data in its file, so reads are bounded by the partition size.
+        const std::size_t elem_count = (p_remaining > 0 ?
+                                        std::fread(static_cast<void*>(dst), sizeof(key_val_pair_t), std::min(count, p_remaining), file_ptr) : 0);
+        if(elem_count > 0)
+        {
+            p_remaining -= elem_count;
+            return elem_count;
         }
+
+        set_file_handle(curr_p_id + 1);
     }
 
-    pos += buf_elem_count;
+    return 0;
+}
 
-    lock.unlock();
 
-    return buf_elem_count;
+template <typename T_key_, typename T_val_>
+inline void Key_Value_Iterator<T_key_, T_val_>::read_ahead()
+{
+    // A single thread per iterator serves all its readaheads, rather than one per chunk.
+    if(!reader.joinable())
+        reader = std::thread(&Key_Value_Iterator::run_reader, this);
+
+    {
+        std::lock_guard<std::mutex> guard(read_mtx);
+        read_requested = true;
+    }
+
+    read_pending = true;
+    read_cv.notify_all();
 }
 
 
 template <typename T_key_, typename T_val_>
-inline void Key_Value_Iterator<T_key_, T_val_>::advance()
+inline std::size_t Key_Value_Iterator<T_key_, T_val_>::wait_read_ahead()
 {
-    if(buf == nullptr)
+    if(!read_pending)
+        return 0;
+
+    std::unique_lock<std::mutex> guard(read_mtx);
+    read_cv.wait(guard, [this]{ return !read_requested; });
+    read_pending = false;
+
+    return read_ahead_count;
+}
+
+
+template <typename T_key_, typename T_val_>
+inline void Key_Value_Iterator<T_key_, T_val_>::run_reader()
+{
+    std::unique_lock<std::mutex> guard(read_mtx);
+    while(true)
+    {
+        read_cv.wait(guard, [this]{ return reader_stop || read_requested; });
+        if(!read_requested)
+            return;
+
+        // The iterator touches neither `buf_ahead` nor the file-handles until the read completes.
+        guard.unlock();
+        const std::size_t count = fill(buf_ahead, buf_sz);
+        guard.lock();
+
+        read_ahead_count = count;
+        read_requested = false;
+        read_cv.notify_all();
+    }
+}
+
+
+template <typename T_key_, typename T_val_>
+inline bool Key_Value_Iterator<T_key_, T_val_>::refill()
+{
+    if(!read_pending)   // Positioned at the end of the collection by a seek.
     {
-        set_file_handle(0);
-        buf = static_cast<key_val_pair_t*>(std::malloc(buf_sz * sizeof(key_val_pair_t)));
+        at_end = true;
+        return false;
     }
 
-    while(buf_idx >= buf_elem_count)
+    buf_elem_count = wait_read_ahead();
+    buf_idx = 0;
+    std::swap(buf, buf_ahead);
+
+    if(buf_elem_count == 0)
     {
-        buf_elem_count = std::fread(static_cast<void*>(buf), sizeof(key_val_pair_t), buf_sz, file_ptr);
-        buf_idx = 0;
+        at_end = true;
+        return false;
+    }
 
-        if(buf_elem_count == 0)
-        {
-            if(++curr_p_id == partition_count)
-            {
-                std::fclose(file_ptr);
+    read_ahead();
+    return true;
+}
 
-                file_ptr = nullptr;
-                at_end = true;
-                return;
-            }
 
-            set_file_handle(curr_p_id);
-        }
+template <typename T_key_, typename T_val_>
+inline void Key_Value_Iterator<T_key_, T_val_>::advance()
+{
+    if(buf == nullptr)
+        start();
+
+    if(buf_idx >= buf_elem_count && !refill())
+    {
+        has_elem = false;
+        return;
     }
 
     elem = buf[buf_idx++];
     pos++;
+    has_elem = true;
 }
 
 
 template <typename T_key_, typename T_val_>
 inline void Key_Value_Iterator<T_key_, T_val_>::advance_key_block()
 {
-    if(buf == nullptr)
+    if(!has_elem)
         advance();
 
+    if(at_end)
+        return;
+
+    // The buffered pairs are from a single sorted partition, so the rest of the key-block is skipped in bulk per
+    // buffer, instead of pair by pair.
     const T_key_ key = elem.first;
-    while(file_ptr != nullptr && elem.first == key)
-        advance();
+    while(true)
+    {
+        const std::size_t block_end = skip_key(buf + buf_idx, buf + buf_elem_count, key) - buf;
+        pos += block_end - buf_idx;
+        buf_idx = block_end;
+
+        if(buf_idx < buf_elem_count)
+            break;
+
+        if(!refill())
+        {
+            has_elem = false;
+            return;
+        }
+    }
+
+    elem = buf[buf_idx++];
+    pos++;
+}
+
+
+template <typename T_key_, typename T_val_>
+inline const typename Key_Value_Iterator<T_key_, T_val_>::key_val_pair_t* Key_Value_Iterator<T_key_, T_val_>::skip_key(const key_val_pair_t* const first, const key_val_pair_t* const last, const T_key_& key)
+{
+    if(first == last || !(first->first == key))  // The range may be from a following partition.
+        return first;
+
+    const auto key_lt = [](const T_key_& key, const key_val_pair_t& pair) { return key < pair.first; };
+
+    // Find a window `(lo, lo + step]` containing the end of the key-block with exponentially growing steps.
+    const key_val_pair_t* lo = first;
+    std::size_t step = 1;
+    while(step < static_cast<std::size_t>(last - lo) && !key_lt(key, lo[step]))
+    {
+        lo += step;
+        step <<= 1;
+    }
+
+    return std::upper_bound(lo, lo + std::min(step, static_cast<std::size_t>(last - lo)), key, key_lt);
+}
+
+
+template <typename T_key_, typename T_val_>
+inline std::FILE* Key_Value_Iterator<T_key_, T_val_>::open_partition(const std::size_t p_id) const
+{
+    std::FILE* const f_ptr = std::fopen(layout->path[p_id].c_str(), "rb");
+    if(f_ptr == nullptr || fseeko(f_ptr, layout->file_offset[p_id], SEEK_SET))
+    {
+        std::cerr << "Error opening partition files. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    return f_ptr;
+}
+
+
+template <typename T_key_, typename T_val_>
+inline std::size_t Key_Value_Iterator<T_key_, T_val_>::non_empty_partition(std::size_t p_id) const
+{
+    while(p_id < partition_count && layout->partition_size(p_id) == 0)
+        p_id++;
+
+    return p_id;
 }
 
 
@@ -278,16 +585,55 @@ template <typename T_key_, typename T_val_>
 inline void Key_Value_Iterator<T_key_, T_val_>::set_file_handle(const std::size_t p_id)
 {
     if(file_ptr != nullptr)
+    {
+        // The partition is read through; its last page, partial, is only padded or at the end of its file.
+        if(layout->read_once && p_remaining == 0)
+            posix_fadvise(fileno(file_ptr), layout->file_offset[curr_p_id],
+                            (layout->partition_size(curr_p_id) * sizeof(key_val_pair_t) + collation_file_align - 1) / collation_file_align * collation_file_align,
+                            POSIX_FADV_DONTNEED);
+
         std::fclose(file_ptr);
+    }
+
+    const std::size_t q_id = non_empty_partition(p_id);
+
+    // The file of the next non-empty partition is opened beforehand at the previous switch.
+    if(next_file_ptr != nullptr && q_id == next_p_id)
+        file_ptr = next_file_ptr;
+    else
+    {
+        if(next_file_ptr != nullptr)
+            std::fclose(next_file_ptr);
+
+        file_ptr = (q_id < partition_count ? open_partition(q_id) : nullptr);
+    }
 
-    file_ptr = std::fopen(partition_file_path(p_id).c_str(), "rb");
+    next_file_ptr = nullptr;
+    curr_p_id = q_id;
     if(file_ptr == nullptr)
     {
-        std::cerr << "Error opening partition files. Aborting.\n";
-        std::exit(EXIT_FAILURE);
+        p_remaining = 0;
+        return;
+    }
+
+    p_remaining = layout->partition_size(q_id);
+    posix_fadvise(fileno(file_ptr), layout->file_offset[q_id], p_remaining * sizeof(key_val_pair_t), POSIX_FADV_SEQUENTIAL);
+
+    // Open the next partition and have the kernel start fetching its first chunk, so that the switch to it costs
+    // neither an `fopen` nor a cold read.
+    next_p_id = non_empty_partition(q_id + 1);
+    if(next_p_id < partition_count)
+    {
+        next_file_ptr = open_partition(next_p_id);
+        posix_fadvise(fileno(next_file_ptr), layout->file_offset[next_p_id],
+                        std::min(buf_sz, layout->partition_size(next_p_id)) * sizeof(key_val_pair_t), POSIX_FADV_WILLNEED);
     }
 }
 
+
+template <typename T_key_, typename T_val_>
+const std::size_t Key_Value_Iterator<T_key_, T_val_>::buf_sz;
+
 }
 
 
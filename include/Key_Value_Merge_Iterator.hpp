@@ -0,0 +1,406 @@
+
+#ifndef KEY_VALUE_MERGE_ITERATOR_HPP
+#define KEY_VALUE_MERGE_ITERATOR_HPP
+
+
+
+#include "Spin_Lock.hpp"
+#include "Collation_Layout.hpp"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+#include <fcntl.h>
+
+
+// =============================================================================
+
+namespace key_value_collator
+{
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_> class Key_Value_Collator;
+
+
+// A class to iterate over key-value pairs of type `(T_key_, T_val_)`, collated
+// by the class `Key_Value_Collator`, in the global sorted order of the pairs.
+// The sorted partitions are merged on-the-fly with a loser tree, each through
+// a buffer of its own that is read ahead by the kernel.
+template <typename T_key_, typename T_val_>
+class Key_Value_Merge_Iterator
+{
+    typedef std::pair<T_key_, T_val_> key_val_pair_t;
+
+private:
+
+    // A sorted run of pairs, i.e. a collated partition, being merged.
+    struct Run
+    {
+        std::size_t p_id;   // ID of the partition.
+        std::FILE* file_ptr;    // Pointer to the partition file.
+        key_val_pair_t* buf;    // Buffer to read in chunks of the run.
+        std::size_t buf_elem_count; // Number of pairs currently in the buffer.
+        std::size_t buf_idx;    // Index of the next pair to merge from the buffer.
+        std::size_t file_off;   // Offset (in bytes) into the file past the buffered pairs.
+        std::size_t remaining;  // Number of pairs of the run yet to be read into the buffer.
+
+        // Returns the next pair to merge from the run.
+        const key_val_pair_t& head() const { return buf[buf_idx]; }
+
+        // Returns `true` iff the run has been merged completely.
+        bool exhausted() const { return buf_idx >= buf_elem_count; }
+    };
+
+    const std::shared_ptr<const Collation_Layout> layout;   // Layout of the collated partitions on disk.
+
+    std::vector<Run> run;   // The runs being merged: the non-empty partitions.
+    std::vector<std::size_t> tree;  // The loser tree: `tree[0]` is the run with the minimum head, and `tree[i]` is the loser run at internal node `i`.
+    bool started;   // Whether the runs have been opened and the tree built.
+
+    std::size_t pos;    // Absolute index of the next pair to process in the sorted collection.
+    bool at_end;    // Whether the iterator is at the end of the collection.
+
+    key_val_pair_t elem;    // Current pair to process.
+    bool has_elem;  // Whether `elem` holds the pair at the iterator's position, i.e. the one preceding `pos`.
+
+    static constexpr std::size_t run_buf_sz = 128lu * 1024lu / sizeof(key_val_pair_t);  // Size of each run's buffer in elements: total 128KB.
+
+    Spin_Lock lock; // Mutually-exclusive access lock for the iterator users.
+
+
+    // Opens the runs, fills their buffers, and builds the loser tree.
+    void start();
+
+    // Reads in the next chunk of the run `r` into its buffer, and hints the
+    // kernel to read the one following it.
+    void refill(Run& r);
+
+    // Returns `true` iff the head of run `i` precedes the head of run `j`;
+    // exhausted runs succeed every other run.
+    bool precedes(std::size_t i, std::size_t j) const;
+
+    // Builds the subtree of the loser tree rooted at node `node`, and returns
+    // the winner run of the subtree.
+    std::size_t build(std::size_t node);
+
+    // Moves the winner run past its head pair, and replays its path of the
+    // loser tree.
+    void pop();
+
+    // Advances in the collection by one key-value pair. Sets `at_end` if the
+    // end of the collection has been reached.
+    void advance();
+
+    // Advances in the collection by one key-block, i.e. passes by all the
+    // pairs that have the same key as the current one.
+    void advance_key_block();
+
+
+public:
+
+    // Constructs a sorted-order iterator over the collated collection with
+    // the on-disk layout `layout`, at the beginning of the collection, or at
+    // its end iff `at_end` is `true`.
+    Key_Value_Merge_Iterator(std::shared_ptr<const Collation_Layout> layout, bool at_end = false);
+
+    // Constructs a sorted-order iterator over the collated collection of
+    // `collator`, at the beginning of the collection, or at its end iff
+    // `at_end` is `true`.
+    template <typename T_hasher_>
+    Key_Value_Merge_Iterator(const Key_Value_Collator<T_key_, T_val_, T_hasher_>& collator, bool at_end = false):
+        Key_Value_Merge_Iterator(collator.collation_layout(), at_end)
+    {}
+
+    // Copy constructs an iterator from the iterator `other`. Only usable with
+    // `other` iterators that are unmodified results of `ordered_begin()` and
+    // `ordered_end()`.
+    Key_Value_Merge_Iterator(const Key_Value_Merge_Iterator& other);
+
+    Key_Value_Merge_Iterator& operator=(const Key_Value_Merge_Iterator&) = delete;
+
+    // Destructs the iterator.
+    ~Key_Value_Merge_Iterator();
+
+    // Returns the key of the current pair.
+    T_key_ operator*();
+
+    // Advances the iterator by one key-block.
+    Key_Value_Merge_Iterator& operator++();
+
+    // Returns `true` iff this iterator and `rhs` point to the same key-block of
+    // the same collection.
+    bool operator==(const Key_Value_Merge_Iterator& rhs) const;
+
+    // Returns `true` iff this iterator and `rhs` point to different key-blocks
+    // of some collection(s).
+    bool operator!=(const Key_Value_Merge_Iterator& rhs) const { return !this->operator==(rhs); }
+
+    // Returns the index of the iterator's current position in the sorted
+    // collection.
+    std::size_t pair_index() const { return pos - has_elem; }
+
+    // Tries to read in at most `count` key-value pairs into `buf`, in sorted
+    // order. Returns the number of pairs read, which is 0 in case when the end
+    // of the collection has been reached. It is thread-safe.
+    std::size_t read(key_val_pair_t* buf, std::size_t count);
+};
+
+
+template <typename T_key_, typename T_val_>
+inline Key_Value_Merge_Iterator<T_key_, T_val_>::Key_Value_Merge_Iterator(std::shared_ptr<const Collation_Layout> layout, const bool at_end):
+    layout(std::move(layout)),
+    started(false),
+    pos(0),
+    at_end(at_end),
+    has_elem(false)
+{
+    if(this->layout == nullptr)
+    {
+        std::cerr << "Sorted-order iteration requires a collated collection of pairs. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    for(std::size_t p_id = 0; p_id < this->layout->partition_count(); ++p_id)
+        if(this->layout->partition_size(p_id) > 0)
+            run.push_back(Run{p_id, nullptr, nullptr, 0, 0, this->layout->file_offset[p_id], this->layout->partition_size(p_id)});
+
+    if(run.empty())
+        this->at_end = true;
+}
+
+
+template <typename T_key_, typename T_val_>
+inline Key_Value_Merge_Iterator<T_key_, T_val_>::Key_Value_Merge_Iterator(const Key_Value_Merge_Iterator& other):
+    layout(other.layout),
+    run(other.run),
+    started(false),
+    pos(other.pos),
+    at_end(other.at_end),
+    has_elem(false)
+{
+    if(other.started)
+    {
+        std::cerr << "Cannot copy sorted-order iterator that is in use. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+
+template <typename T_key_, typename T_val_>
+inline Key_Value_Merge_Iterator<T_key_, T_val_>::~Key_Value_Merge_Iterator()
+{
+    if(started)
+        for(Run& r : run)
+        {
+            if(r.file_ptr != nullptr)
+                std::fclose(r.file_ptr);
+
+            std::free(r.buf);
+        }
+}
+
+
+template <typename T_key_, typename T_val_>
+inline void Key_Value_Merge_Iterator<T_key_, T_val_>::start()
+{
+    for(Run& r : run)
+    {
+        r.file_ptr = std::fopen(layout->path[r.p_id].c_str(), "rb");
+        r.buf = static_cast<key_val_pair_t*>(std::malloc(run_buf_sz * sizeof(key_val_pair_t)));
+        if(r.file_ptr == nullptr || r.buf == nullptr || fseeko(r.file_ptr, r.file_off, SEEK_SET))
+        {
+            std::cerr << "Error opening partition files. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        refill(r);
+    }
+
+    tree.resize(run.size());
+    tree[0] = build(1);
+    started = true;
+}
+
+
+template <typename T_key_, typename T_val_>
+inline void Key_Value_Merge_Iterator<T_key_, T_val_>::refill(Run& r)
+{
+    r.buf_elem_count = (r.remaining > 0 ? std::fread(static_cast<void*>(r.buf), sizeof(key_val_pair_t), std::min(run_buf_sz, r.remaining), r.file_ptr) : 0);
+    r.buf_idx = 0;
+    if(layout->read_once && r.buf_elem_count > 0)   // The last page of a run, partial, is dropped with its last chunk.
+    {
+        const std::size_t bytes = r.buf_elem_count * sizeof(key_val_pair_t);
+        posix_fadvise(fileno(r.file_ptr), r.file_off,
+                        r.buf_elem_count < r.remaining ? bytes : (bytes + collation_file_align - 1) / collation_file_align * collation_file_align,
+                        POSIX_FADV_DONTNEED);
+    }
+
+    r.file_off += r.buf_elem_count * sizeof(key_val_pair_t);
+    r.remaining -= r.buf_elem_count;
+
+    if(r.remaining > 0)
+        posix_fadvise(fileno(r.file_ptr), r.file_off, std::min(run_buf_sz, r.remaining) * sizeof(key_val_pair_t), POSIX_FADV_WILLNEED);
+}
+
+
+template <typename T_key_, typename T_val_>
+inline bool Key_Value_Merge_Iterator<T_key_, T_val_>::precedes(const std::size_t i, const std::size_t j) const
+{
+    if(run[i].exhausted())
+        return false;
+
+    if(run[j].exhausted())
+        return true;
+
+    return run[i].head() < run[j].head();
+}
+
+
+template <typename T_key_, typename T_val_>
+inline std::size_t Key_Value_Merge_Iterator<T_key_, T_val_>::build(const std::size_t node)
+{
+    // The leaves of the tree, i.e. the runs, are at the nodes `[k, 2k)` for `k` runs.
+    if(node >= run.size())
+        return node - run.size();
+
+    const std::size_t l = build(2 * node);
+    const std::size_t r = build(2 * node + 1);
+    const bool l_wins = !precedes(r, l);
+    tree[node] = (l_wins ? r : l);
+
+    return l_wins ? l : r;
+}
+
+
+template <typename T_key_, typename T_val_>
+inline void Key_Value_Merge_Iterator<T_key_, T_val_>::pop()
+{
+    std::size_t winner = tree[0];
+    Run& r = run[winner];
+    if(++r.buf_idx == r.buf_elem_count)
+        refill(r);
+
+    for(std::size_t node = (winner + run.size()) / 2; node > 0; node /= 2)
+        if(precedes(tree[node], winner))
+            std::swap(tree[node], winner);
+
+    tree[0] = winner;
+}
+
+
+template <typename T_key_, typename T_val_>
+inline T_key_ Key_Value_Merge_Iterator<T_key_, T_val_>::operator*()
+{
+    if(!has_elem)
+        advance();
+
+    return elem.first;
+}
+
+
+template <typename T_key_, typename T_val_>
+inline Key_Value_Merge_Iterator<T_key_, T_val_>& Key_Value_Merge_Iterator<T_key_, T_val_>::operator++()
+{
+    advance_key_block();
+
+    return *this;
+}
+
+
+template <typename T_key_, typename T_val_>
+inline bool Key_Value_Merge_Iterator<T_key_, T_val_>::operator==(const Key_Value_Merge_Iterator& rhs) const
+{
+    if(at_end || rhs.at_end)
+        return at_end == rhs.at_end;
+
+    return layout == rhs.layout && pair_index() == rhs.pair_index();
+}
+
+
+template <typename T_key_, typename T_val_>
+inline void Key_Value_Merge_Iterator<T_key_, T_val_>::advance()
+{
+    if(at_end)
+        return;
+
+    if(!started)
+        start();
+
+    if(run[tree[0]].exhausted())
+    {
+        at_end = true;
+        has_elem = false;
+        return;
+    }
+
+    elem = run[tree[0]].head();
+    pop();
+    pos++;
+    has_elem = true;
+}
+
+
+template <typename T_key_, typename T_val_>
+inline void Key_Value_Merge_Iterator<T_key_, T_val_>::advance_key_block()
+{
+    if(!has_elem)
+        advance();
+
+    if(at_end)
+        return;
+
+    const T_key_ key = elem.first;
+    while(!run[tree[0]].exhausted() && run[tree[0]].head().first == key)
+    {
+        pop();
+        pos++;
+    }
+
+    advance();
+}
+
+
+template <typename T_key_, typename T_val_>
+inline std::size_t Key_Value_Merge_Iterator<T_key_, T_val_>::read(key_val_pair_t* const buf, const std::size_t count)
+{
+    lock.lock();
+
+    if(!at_end && !started)
+        start();
+
+    std::size_t read_count = 0;
+    if(!at_end)
+    {
+        while(read_count < count && !run[tree[0]].exhausted())
+        {
+            buf[read_count++] = run[tree[0]].head();
+            pop();
+        }
+
+        if(read_count == 0)
+            at_end = true;
+    }
+
+    pos += read_count;
+    has_elem = false;
+
+    lock.unlock();
+
+    return read_count;
+}
+
+
+template <typename T_key_, typename T_val_>
+const std::size_t Key_Value_Merge_Iterator<T_key_, T_val_>::run_buf_sz;
+
+}
+
+
+
+#endif
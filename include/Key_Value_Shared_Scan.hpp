@@ -0,0 +1,307 @@
+
+#ifndef KEY_VALUE_SHARED_SCAN_HPP
+#define KEY_VALUE_SHARED_SCAN_HPP
+
+
+
+#include "Key_Value_Batch_Reader.hpp"
+
+#include <cstddef>
+#include <utility>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+
+// =============================================================================
+
+namespace key_value_collator
+{
+
+
+// A class to share one sequential scan over key-value pairs of type
+// `(T_key_, T_val_)`, collated by the class `Key_Value_Collator`, among a
+// fixed number of consumers. A background thread reads each chunk of the
+// collection once into a ring of buffers, and every consumer visits every
+// chunk through its own cursor. The fastest consumer can run ahead of the
+// slowest one by at most the number of buffers in the ring. The scanner and
+// the consumers waiting on each other sleep on condition variables.
+template <typename T_key_, typename T_val_>
+class Key_Value_Shared_Scan
+{
+    typedef std::pair<T_key_, T_val_> key_val_pair_t;
+
+public:
+
+    class Cursor;
+
+
+private:
+
+    // A buffer of the ring.
+    struct Slot
+    {
+        key_val_pair_t* data;   // The buffered pairs.
+        std::size_t count;  // Number of pairs in the buffer.
+        std::size_t pending;    // Number of consumers yet to be done with the buffer.
+    };
+
+    Key_Value_Batch_Reader<T_key_, T_val_> reader;  // Reader for the chunks of the collection.
+
+    const std::size_t consumer_count;   // Number of consumers sharing the scan.
+    std::size_t registered; // Number of cursors registered so far.
+
+    const std::size_t slot_count;   // Number of buffers in the ring.
+    std::unique_ptr<Slot[]> slot;   // The ring of buffers; chunk `i` is read into `slot[i % slot_count]`.
+
+    std::size_t produced;   // Number of chunks read so far.
+    bool done;  // Whether all the chunks have been read.
+    bool stop;  // Whether the scan is being abandoned.
+
+    std::mutex mtx; // Mutex for the state of the ring and the registrations.
+    std::condition_variable produced_cv;    // Notifies the consumers of the chunks read, and of the end of the scan.
+    std::condition_variable released_cv;    // Notifies the scanner of the buffers released, and of the cursors registered.
+
+    std::thread* scanner;   // The background thread reading the chunks into the ring.
+
+    static constexpr std::size_t slot_count_default = 4;    // Default value for the number of buffers in the ring.
+    static constexpr std::size_t register_timeout_sec = 60; // Seconds to wait for the rest of the cursors once the first one is registered.
+
+
+    // Reads the chunks of the collection in order into the ring, as the
+    // buffers get free, once all the cursors are registered.
+    void scan();
+
+
+public:
+
+    Key_Value_Shared_Scan(const Key_Value_Shared_Scan&) = delete;
+    Key_Value_Shared_Scan& operator=(const Key_Value_Shared_Scan&) = delete;
+
+    // Constructs a shared scan over the collated collection with the on-disk
+    // layout `layout`, for `consumer_count` consumers. `slot_count` buffers,
+    // each of `chunk_sz` pairs, bound the lag between the consumers. Exactly
+    // `consumer_count` cursors must be constructed over the scan; the reads
+    // start once they all are, and the scan aborts if they are not within a
+    // minute of the first.
+    Key_Value_Shared_Scan(std::shared_ptr<const Collation_Layout> layout, std::size_t consumer_count, std::size_t slot_count = slot_count_default, std::size_t chunk_sz = Key_Value_Batch_Reader<T_key_, T_val_>::chunk_sz_default);
+
+    // Constructs a shared scan over the collated collection of `collator`, for
+    // `consumer_count` consumers, with `slot_count` buffers of `chunk_sz`
+    // pairs each.
+    template <typename T_hasher_>
+    Key_Value_Shared_Scan(const Key_Value_Collator<T_key_, T_val_, T_hasher_>& collator, std::size_t consumer_count, std::size_t slot_count = slot_count_default, std::size_t chunk_sz = Key_Value_Batch_Reader<T_key_, T_val_>::chunk_sz_default):
+        Key_Value_Shared_Scan(collator.collation_layout(), consumer_count, slot_count, chunk_sz)
+    {}
+
+    ~Key_Value_Shared_Scan();
+};
+
+
+// A consumer's cursor over a shared scan. A cursor must be used from a single
+// thread.
+template <typename T_key_, typename T_val_>
+class Key_Value_Shared_Scan<T_key_, T_val_>::Cursor
+{
+private:
+
+    Key_Value_Shared_Scan& scan;    // The scan this cursor is registered to.
+    std::size_t c_id;   // Index of the next chunk to visit.
+    bool holding;   // Whether the cursor holds the buffer of the chunk preceding `c_id`.
+
+
+    // Releases the buffer held, if any. The scan's mutex is to be held.
+    void release();
+
+
+public:
+
+    Cursor(const Cursor&) = delete;
+    Cursor& operator=(const Cursor&) = delete;
+
+    // Constructs a cursor at the beginning of the shared scan `scan`.
+    explicit Cursor(Key_Value_Shared_Scan& scan);
+
+    // Destructs the cursor. The remaining chunks are passed over so that the
+    // other consumers are not stalled.
+    ~Cursor();
+
+    // Tries to fetch the next chunk of pairs, pointing `data` to them. The
+    // pairs stay valid until the next invocation. Returns the number of pairs
+    // in the chunk, which is 0 in case when the end of the collection has been
+    // reached.
+    std::size_t next(const key_val_pair_t*& data);
+};
+
+
+template <typename T_key_, typename T_val_>
+inline Key_Value_Shared_Scan<T_key_, T_val_>::Key_Value_Shared_Scan(std::shared_ptr<const Collation_Layout> layout, const std::size_t consumer_count, const std::size_t slot_count, const std::size_t chunk_sz):
+    reader(std::move(layout), chunk_sz),
+    consumer_count(consumer_count),
+    registered(0),
+    slot_count(slot_count),
+    slot(new Slot[slot_count]),
+    produced(0),
+    done(false),
+    stop(false),
+    scanner(nullptr)
+{
+    if(consumer_count == 0 || slot_count == 0)
+    {
+        std::cerr << "Shared scan requires non-zero consumer and buffer counts. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    for(std::size_t i = 0; i < slot_count; ++i)
+    {
+        slot[i].data = static_cast<key_val_pair_t*>(std::malloc(chunk_sz * sizeof(key_val_pair_t)));
+        slot[i].count = 0;
+        slot[i].pending = 0;
+
+        if(slot[i].data == nullptr)
+        {
+            std::cerr << "Error allocating buffers for shared scan. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    scanner = new std::thread(&Key_Value_Shared_Scan::scan, this);
+}
+
+
+template <typename T_key_, typename T_val_>
+inline Key_Value_Shared_Scan<T_key_, T_val_>::~Key_Value_Shared_Scan()
+{
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        stop = true;
+    }
+
+    produced_cv.notify_all();
+    released_cv.notify_all();
+    scanner->join();
+    delete scanner;
+
+    for(std::size_t i = 0; i < slot_count; ++i)
+        std::free(slot[i].data);
+}
+
+
+template <typename T_key_, typename T_val_>
+inline void Key_Value_Shared_Scan<T_key_, T_val_>::scan()
+{
+    std::unique_lock<std::mutex> guard(mtx);
+
+    // A buffer is only released by all the consumers, so none is read into before they are all registered.
+    released_cv.wait(guard, [this]{ return stop || registered > 0; });
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(register_timeout_sec);
+    if(!released_cv.wait_until(guard, deadline, [this]{ return stop || registered == consumer_count; }))
+    {
+        std::cerr << "Only " << registered << " of the " << consumer_count << " cursors of a shared scan were constructed. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    for(std::size_t c_id = 0; ; ++c_id)
+    {
+        Slot& s = slot[c_id % slot_count];
+        released_cv.wait(guard, [this, &s]{ return stop || s.pending == 0; });
+        if(stop)
+            return;
+
+        // The buffer is not visible to the consumers until the chunk is published below.
+        guard.unlock();
+        const std::size_t count = reader.read(s.data);
+        guard.lock();
+
+        s.count = count;
+        if(count == 0)
+            done = true;
+        else
+        {
+            s.pending = consumer_count;
+            produced = c_id + 1;
+        }
+
+        produced_cv.notify_all();
+        if(done)
+            return;
+    }
+}
+
+
+template <typename T_key_, typename T_val_>
+inline Key_Value_Shared_Scan<T_key_, T_val_>::Cursor::Cursor(Key_Value_Shared_Scan& scan):
+    scan(scan),
+    c_id(0),
+    holding(false)
+{
+    {
+        std::lock_guard<std::mutex> guard(scan.mtx);
+        if(scan.registered >= scan.consumer_count)
+        {
+            std::cerr << "More cursors registered to a shared scan than its consumer count. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        scan.registered++;
+    }
+
+    scan.released_cv.notify_all();
+}
+
+
+template <typename T_key_, typename T_val_>
+inline Key_Value_Shared_Scan<T_key_, T_val_>::Cursor::~Cursor()
+{
+    const key_val_pair_t* data;
+    while(next(data));
+}
+
+
+template <typename T_key_, typename T_val_>
+inline void Key_Value_Shared_Scan<T_key_, T_val_>::Cursor::release()
+{
+    if(holding)
+    {
+        if(--scan.slot[(c_id - 1) % scan.slot_count].pending == 0)
+            scan.released_cv.notify_all();
+
+        holding = false;
+    }
+}
+
+
+template <typename T_key_, typename T_val_>
+inline std::size_t Key_Value_Shared_Scan<T_key_, T_val_>::Cursor::next(const key_val_pair_t*& data)
+{
+    std::unique_lock<std::mutex> guard(scan.mtx);
+    release();
+
+    scan.produced_cv.wait(guard, [this]{ return scan.stop || scan.done || scan.produced > c_id; });
+    if(scan.stop || scan.produced <= c_id)
+        return 0;
+
+    const Slot& s = scan.slot[c_id % scan.slot_count];
+    data = s.data;
+    c_id++;
+    holding = true;
+
+    return s.count;
+}
+
+
+template <typename T_key_, typename T_val_>
+const std::size_t Key_Value_Shared_Scan<T_key_, T_val_>::slot_count_default;
+
+template <typename T_key_, typename T_val_>
+const std::size_t Key_Value_Shared_Scan<T_key_, T_val_>::register_timeout_sec;
+
+}
+
+
+
+#endif
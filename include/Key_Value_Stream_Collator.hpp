@@ -0,0 +1,378 @@
+
+#ifndef KEY_VALUE_STREAM_COLLATOR_HPP
+#define KEY_VALUE_STREAM_COLLATOR_HPP
+
+
+
+#include "Spin_Lock.hpp"
+#include "Collation_Layout.hpp"
+#include "Key_Value_Collator.hpp"
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+
+
+// =============================================================================
+
+namespace key_value_collator
+{
+
+
+// A class to collate a continuous stream of key-value pairs, deposited from
+// multiple producers, in windows called epochs. Keys are of type `T_key_`,
+// values are of type `T_val_`, and the keys are hashed to their partitions with
+// `T_hasher_`. The deposits go to the current epoch; rotating the epoch seals
+// it and hands it to a background thread to be collated, while the producers
+// keep depositing into the next epoch. Each epoch is a `Key_Value_Collator` of
+// its own, and the collated epochs are read either separately or merged.
+template <typename T_key_, typename T_val_, typename T_hasher_>
+class Key_Value_Stream_Collator
+{
+public:
+
+    typedef Key_Value_Collator<T_key_, T_val_, T_hasher_> collator_t;   // Type of the collator of an epoch.
+    typedef typename collator_t::buf_t buf_t;   // Type of the data buffers.
+    typedef typename collator_t::iter_t iter_t; // Type of the iterator over collated epochs.
+    typedef typename collator_t::ordered_iter_t ordered_iter_t; // Type of the sorted-order iterator over collated epochs.
+
+
+private:
+
+    // An epoch of the stream.
+    struct Epoch
+    {
+        const std::size_t id;   // Sequence number of the epoch.
+        collator_t collator;    // Collator of the pairs deposited in the epoch.
+        std::size_t active; // Number of the epoch's buffers held by the producers.
+        std::atomic<bool> collated; // Whether the epoch has been collated.
+        std::thread* worker;    // The background thread collating the epoch, once sealed.
+
+        Epoch(std::size_t id, const std::string& work_file_pref, std::size_t buf_count):
+            id(id), collator(work_file_pref, buf_count), active(0), collated(false), worker(nullptr)
+        {}
+    };
+
+    const std::string work_file_pref;   // Path-prefix of the working files of the epochs.
+    const std::size_t buf_count;    // Number of concurrent buffers for the producers, per epoch.
+    const uint32_t thread_count;    // Number of processor-threads to collate an epoch with.
+    const bool aggregate;   // Whether to generate the aggregate results of the epochs.
+    const std::size_t max_in_flight;    // Maximum number of sealed epochs being collated at a time.
+
+    Epoch* curr;    // The epoch currently receiving deposits.
+    std::size_t next_id;    // Sequence number of the next epoch to start.
+
+    std::map<std::size_t, Epoch*> sealed;   // The sealed epochs not released yet, by their sequence numbers.
+    Spin_Lock sealed_lock;  // Mutual-exclusion lock for the sealed epochs.
+
+    std::mutex collated_mtx;    // Mutex for waiting on the collations of the epochs.
+    std::condition_variable collated_cv;    // Notifies the end of the collation of an epoch.
+
+    std::unordered_map<const buf_t*, Epoch*> owner;   // The epochs of the buffers held by the producers.
+    std::mutex owner_mtx;   // Mutex for the current epoch, the buffer owners, and the counts of the buffers held.
+    std::condition_variable returned_cv;    // Notifies the return of the last buffer held of an epoch.
+
+    static constexpr std::size_t max_in_flight_default = 2; // Default maximum number of sealed epochs being collated at a time.
+
+
+    // Returns the path-prefix of the working files of the epoch `id`.
+    const std::string epoch_file_pref(std::size_t id) const { return work_file_pref + ".epoch" + std::to_string(id); }
+
+    // Returns the number of sealed epochs being collated.
+    std::size_t in_flight_count();
+
+    // Returns the sealed epoch `id`, after waiting for its collation to end.
+    Epoch& collated_epoch(std::size_t id);
+
+    // Collates the sealed epoch `e`, after waiting for the producers to
+    // return its buffers.
+    void collate_epoch(Epoch& e);
+
+
+public:
+
+    Key_Value_Stream_Collator(const Key_Value_Stream_Collator&) = delete;
+    Key_Value_Stream_Collator& operator=(const Key_Value_Stream_Collator&) = delete;
+
+    // Constructs a streaming collator with working files at the path-prefix
+    // `work_file_pref`, and `buf_count` concurrent buffers per epoch. Sealed
+    // epochs are collated with `thread_count` processor-threads each, with
+    // aggregate results iff `aggregate = true`, and at most `max_in_flight` of
+    // them are collated at a time, to bound the memory in use.
+    Key_Value_Stream_Collator(const std::string& work_file_pref, std::size_t buf_count, uint32_t thread_count, bool aggregate = false, std::size_t max_in_flight = max_in_flight_default);
+
+    // Destructs the streaming collator, discarding all its epochs. All the
+    // buffers must have been returned by the producers before this.
+    ~Key_Value_Stream_Collator();
+
+    // Returns an available free buffer of the current epoch.
+    buf_t& get_buffer();
+
+    // Returns the buffer `buf` to its epoch with deposited data.
+    void return_buffer(buf_t& buf);
+
+    // Seals the current epoch, to be collated in the background, and starts a
+    // new epoch for the deposits. Waits while the maximum number of epochs are
+    // being collated. Returns the sequence number of the sealed epoch. It must
+    // not be invoked concurrently with itself.
+    std::size_t rotate();
+
+    // Returns `true` iff the sealed epoch `id` has been collated.
+    bool collated(std::size_t id);
+
+    // Returns the collator of the sealed epoch `id`, after waiting for its
+    // collation to end. It stays valid until the epoch is released.
+    const collator_t& epoch(std::size_t id) { return collated_epoch(id).collator; }
+
+    // Returns the on-disk layout of the sealed epochs `first` to `last`
+    // (inclusive) merged into one collection, after waiting for them to be
+    // collated. The layout is usable with the readers of collations; the
+    // sorted-order iterator over it merges the epochs.
+    std::shared_ptr<const Collation_Layout> collation_layout(std::size_t first, std::size_t last);
+
+    // Returns an iterator over the sealed epochs `first` to `last` (inclusive)
+    // in the global sorted order of the pairs.
+    ordered_iter_t ordered_begin(std::size_t first, std::size_t last) { return ordered_iter_t(collation_layout(first, last)); }
+
+    // Releases the sealed epoch `id`, removing its collation, after waiting
+    // for it to be collated. Its readers must be destructed before this.
+    void release(std::size_t id);
+};
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline Key_Value_Stream_Collator<T_key_, T_val_, T_hasher_>::Key_Value_Stream_Collator(const std::string& work_file_pref, const std::size_t buf_count, const uint32_t thread_count, const bool aggregate, const std::size_t max_in_flight):
+    work_file_pref(work_file_pref),
+    buf_count(buf_count),
+    thread_count(thread_count),
+    aggregate(aggregate),
+    max_in_flight(max_in_flight),
+    curr(nullptr),
+    next_id(0)
+{
+    if(thread_count == 0 || max_in_flight == 0)
+    {
+        std::cerr << "Streaming collator requires non-zero thread and in-flight epoch counts. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    curr = new Epoch(next_id, epoch_file_pref(next_id), buf_count);
+    next_id++;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline Key_Value_Stream_Collator<T_key_, T_val_, T_hasher_>::~Key_Value_Stream_Collator()
+{
+    Epoch* const e = curr;
+    if(e->active > 0)
+    {
+        std::cerr << "Streaming collator destructed while buffers remained with producers. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    e->collator.close_deposit_stream();
+    delete e;
+
+    while(!sealed.empty())
+        release(sealed.begin()->first);
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline typename Key_Value_Stream_Collator<T_key_, T_val_, T_hasher_>::buf_t& Key_Value_Stream_Collator<T_key_, T_val_, T_hasher_>::get_buffer()
+{
+    // Pin the current epoch under the mutex, so that a rotation either precedes the pinning or its collation waits
+    // for the buffer; a sealed epoch is never pinned, and a pinned one is never released.
+    Epoch* e;
+    {
+        std::lock_guard<std::mutex> guard(owner_mtx);
+        e = curr;
+        e->active++;
+    }
+
+    buf_t& buf = e->collator.get_buffer();
+
+    std::lock_guard<std::mutex> guard(owner_mtx);
+    owner[&buf] = e;
+
+    return buf;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Stream_Collator<T_key_, T_val_, T_hasher_>::return_buffer(buf_t& buf)
+{
+    Epoch* e;
+    {
+        std::lock_guard<std::mutex> guard(owner_mtx);
+        const auto it = owner.find(&buf);
+        e = (it != owner.end() ? it->second : nullptr);
+        if(e != nullptr)
+            owner.erase(it);
+    }
+
+    if(e == nullptr)
+    {
+        std::cerr << "Buffer returned to a streaming collator that did not provide it. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    e->collator.return_buffer(buf);
+
+    // Notified under the mutex, as the epoch may be collated and released as soon as its count drops.
+    std::lock_guard<std::mutex> guard(owner_mtx);
+    if(--e->active == 0)
+        returned_cv.notify_all();
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline std::size_t Key_Value_Stream_Collator<T_key_, T_val_, T_hasher_>::in_flight_count()
+{
+    std::size_t count = 0;
+
+    sealed_lock.lock();
+    for(const auto& p : sealed)
+        count += !p.second->collated.load(std::memory_order_acquire);
+    sealed_lock.unlock();
+
+    return count;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline std::size_t Key_Value_Stream_Collator<T_key_, T_val_, T_hasher_>::rotate()
+{
+    {
+        std::unique_lock<std::mutex> guard(collated_mtx);
+        collated_cv.wait(guard, [this]{ return in_flight_count() < max_in_flight; });
+    }
+
+    // The next epoch is set up before the swap, so that the producers do not wait on it.
+    Epoch* const next = new Epoch(next_id, epoch_file_pref(next_id), buf_count);
+    next_id++;
+    Epoch* e;
+    {
+        std::lock_guard<std::mutex> guard(owner_mtx);
+        e = curr;
+        curr = next;
+    }
+
+    sealed_lock.lock();
+    sealed[e->id] = e;
+    sealed_lock.unlock();
+
+    e->worker = new std::thread(&Key_Value_Stream_Collator::collate_epoch, this, std::ref(*e));
+
+    return e->id;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Stream_Collator<T_key_, T_val_, T_hasher_>::collate_epoch(Epoch& e)
+{
+    // Producers pinned to the epoch before its sealing may yet return its buffers.
+    {
+        std::unique_lock<std::mutex> guard(owner_mtx);
+        returned_cv.wait(guard, [&e]{ return e.active == 0; });
+    }
+
+    e.collator.close_deposit_stream();
+    e.collator.collate(thread_count, aggregate);
+
+    // Set under the mutex, so that a waiter checking the epoch does not miss the notification.
+    {
+        std::lock_guard<std::mutex> guard(collated_mtx);
+        e.collated.store(true, std::memory_order_release);
+    }
+
+    collated_cv.notify_all();
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline bool Key_Value_Stream_Collator<T_key_, T_val_, T_hasher_>::collated(const std::size_t id)
+{
+    sealed_lock.lock();
+    const auto it = sealed.find(id);
+    const bool is_collated = (it != sealed.end() && it->second->collated.load(std::memory_order_acquire));
+    sealed_lock.unlock();
+
+    return is_collated;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline typename Key_Value_Stream_Collator<T_key_, T_val_, T_hasher_>::Epoch& Key_Value_Stream_Collator<T_key_, T_val_, T_hasher_>::collated_epoch(const std::size_t id)
+{
+    sealed_lock.lock();
+    const auto it = sealed.find(id);
+    Epoch* const e = (it != sealed.end() ? it->second : nullptr);
+    sealed_lock.unlock();
+
+    if(e == nullptr)
+    {
+        std::cerr << "Epoch " << id << " is not a sealed epoch of the streaming collator. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::unique_lock<std::mutex> guard(collated_mtx);
+    collated_cv.wait(guard, [e]{ return e->collated.load(std::memory_order_acquire); });
+
+    return *e;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline std::shared_ptr<const Collation_Layout> Key_Value_Stream_Collator<T_key_, T_val_, T_hasher_>::collation_layout(const std::size_t first, const std::size_t last)
+{
+    auto l = std::make_shared<Collation_Layout>();
+    l->pair_offset.push_back(0);
+    for(std::size_t id = first; id <= last; ++id)
+    {
+        const Collation_Layout& e_layout = *collated_epoch(id).collator.collation_layout();
+        for(std::size_t p_id = 0; p_id < e_layout.partition_count(); ++p_id)
+        {
+            l->path.emplace_back(e_layout.path[p_id]);
+            l->file_offset.emplace_back(e_layout.file_offset[p_id]);
+            l->pair_offset.emplace_back(l->pair_offset.back() + e_layout.partition_size(p_id));
+        }
+    }
+
+    return l;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+inline void Key_Value_Stream_Collator<T_key_, T_val_, T_hasher_>::release(const std::size_t id)
+{
+    Epoch& e = collated_epoch(id);
+    e.worker->join();
+    delete e.worker;
+
+    sealed_lock.lock();
+    sealed.erase(id);
+    sealed_lock.unlock();
+
+    delete &e;
+}
+
+
+template <typename T_key_, typename T_val_, typename T_hasher_>
+const std::size_t Key_Value_Stream_Collator<T_key_, T_val_, T_hasher_>::max_in_flight_default;
+
+}
+
+
+
+#endif
@@ -0,0 +1,533 @@
+
+#ifndef SHARED_BUFFER_POOL_HPP
+#define SHARED_BUFFER_POOL_HPP
+
+
+
+#include "Collation_Layout.hpp"
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <atomic>
+#include <utility>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <cerrno>
+#include <ctime>
+
+
+// =============================================================================
+
+namespace key_value_collator
+{
+
+
+// A shared-memory region of a `Shared_Buffer_Pool` begins with this header,
+// followed by the free-buffer stack (`buf_count` 32-bit buffer indices), the
+// full-buffer ring (`buf_count` 32-bit indices), the pair-counts of the
+// buffers (`buf_count` 64-bit counts), and the holders of the buffers
+// (`buf_count` 32-bit process IDs); the buffers themselves start at
+// `buf_offset`, `buf_stride` bytes apart. The stacks, counts, and holders are
+// guarded by `lock`: a word taken by atomically exchanging 0 for the process
+// ID of the taker, and released by storing 0, waking the sleepers on it with
+// `FUTEX_WAKE` if `lock_waiters` is nonzero. A producer records its process ID
+// as the holder of a buffer as it takes the buffer free, and clears it as it
+// returns the buffer full. Waiters for a free (or a full) buffer sleep with
+// `FUTEX_WAIT` on `free_signal` (or `full_signal`), which is incremented under
+// the lock each time a buffer is returned free (or full), waking the sleepers
+// with `FUTEX_WAKE` if `free_waiters` (or `full_waiters`) is nonzero. So
+// producers in other languages can deposit through the region with the same
+// protocol. The process IDs let the collator and the producers find a lock or
+// buffers held by a process that exited; so they share a PID namespace.
+struct Shared_Buffer_Pool_Header
+{
+    char magic[8];  // Identifier of the region format: `shared_buffer_pool_magic`.
+    uint32_t version;   // Version of the region format.
+    uint32_t pair_size; // Size of a key-value pair in bytes.
+    uint64_t key_type_id;   // Identifier of the key type; see `type_id`.
+    uint64_t val_type_id;   // Identifier of the value type.
+    uint32_t buf_count; // Number of buffers.
+    uint32_t buf_capacity;  // Number of key-value pairs a buffer holds.
+    uint64_t buf_offset;    // Byte-offset of the first buffer into the region.
+    uint64_t buf_stride;    // Distance between the buffers in bytes.
+
+    std::atomic<uint32_t> lock; // Lock for the buffer stacks, counts, and holders: the process ID of its holder, or 0.
+    uint32_t free_count;    // Number of buffers in the free-buffer stack.
+    uint32_t full_head; // Position of the oldest buffer in the full-buffer ring.
+    uint32_t full_count;    // Number of buffers in the full-buffer ring.
+    std::atomic<uint32_t> free_signal;  // Futex word incremented at each return of a free buffer.
+    std::atomic<uint32_t> free_waiters; // Number of sleepers for free buffers.
+    std::atomic<uint32_t> full_signal;  // Futex word incremented at each return of a full buffer.
+    std::atomic<uint32_t> full_waiters; // Number of sleepers for full buffers.
+    std::atomic<uint32_t> closed;   // Whether the collator has stopped accepting buffers.
+    std::atomic<uint32_t> lock_waiters; // Number of sleepers for the lock.
+};
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "Futex words must be plain 32-bit words in shared memory.");
+
+
+constexpr char shared_buffer_pool_magic[8] = {'K', 'V', 'C', 'S', 'H', 'B', 'U', 'F'};
+constexpr uint32_t shared_buffer_pool_version = 2;
+
+
+// A pool of buffers of key-value pairs of type `(T_key_, T_val_)` in a
+// shared-memory region, for producers in other processes to deposit into a
+// collator. The collator creates the region at a path, e.g. on `/dev/shm`, and
+// the producers attach to it; each buffer is either "free" or "full", as in
+// `Buffer_Pool`, and the collator's mapper reads the full ones in place.
+template <typename T_key_, typename T_val_>
+class Shared_Buffer_Pool
+{
+public:
+
+    typedef std::pair<T_key_, T_val_> key_val_pair_t;
+
+
+    // A buffer of the pool, held by a producer while it fills the buffer in,
+    // or by the collator while it maps the buffer.
+    struct Buffer
+    {
+        uint32_t id;    // Index of the buffer in the pool.
+        key_val_pair_t* pairs;  // The pairs of the buffer, in the shared-memory region.
+        std::size_t capacity;   // Number of pairs the buffer holds.
+        std::size_t size;   // Number of pairs in the buffer.
+
+        // Returns whether the buffer is full.
+        bool full() const { return size == capacity; }
+
+        // Appends the pair `key_val_pair` to the buffer, which must not be full.
+        void push_back(const key_val_pair_t& key_val_pair) { pairs[size++] = key_val_pair; }
+    };
+
+
+private:
+
+    const std::string path; // Path to the file of the shared-memory region.
+    const bool owner;   // Whether this pool has created the region, and removes it.
+    std::size_t region_bytes;   // Size of the region in bytes.
+    Shared_Buffer_Pool_Header* header;  // Header of the region.
+    uint32_t* free_stack;   // Indices of the free buffers.
+    uint32_t* full_ring;    // Indices of the full buffers, oldest first from `full_head`.
+    uint64_t* buf_size; // `buf_size[i]` is the pair-count of buffer `i` while it is full.
+    uint32_t* buf_holder;   // `buf_holder[i]` is the process ID of the producer holding buffer `i`, or 0.
+    char* buf_base; // The first buffer.
+
+    static constexpr std::size_t lock_spin_count = 1024;    // Attempts at the lock before sleeping on it, as it is held only briefly.
+
+
+    // Maps the region of `region_bytes` bytes in the file `fd`, and sets the
+    // pointers into it.
+    void map_region(int fd);
+
+    // Returns the buffer with index `id`.
+    Buffer buffer(uint32_t id, std::size_t size) const;
+
+    // Takes the lock of the region; aborts if its holder has exited while
+    // holding it, leaving the region inconsistent.
+    void lock();
+
+    void unlock();  // Releases the lock of the region.
+
+    // Sleeps on the futex word `signal` while its value is `seq`, for up to a
+    // second, so that the sleepers get to check on the other processes.
+    static void wait(std::atomic<uint32_t>& signal, uint32_t seq);
+
+    // Returns `true` iff the process with ID `pid` exists.
+    static bool process_exists(uint32_t pid) { return kill(static_cast<pid_t>(pid), 0) == 0 || errno != ESRCH; }
+
+    // Wakes all the sleepers on the futex word `signal`.
+    static void wake(std::atomic<uint32_t>& signal);
+
+
+public:
+
+    // Creates a pool of `buf_count` buffers of `buf_capacity` pairs each, in a
+    // shared-memory region at the path `path`.
+    Shared_Buffer_Pool(const std::string& path, std::size_t buf_count, std::size_t buf_capacity);
+
+    // Attaches to the pool created at the path `path`.
+    explicit Shared_Buffer_Pool(const std::string& path);
+
+    Shared_Buffer_Pool(const Shared_Buffer_Pool&) = delete;
+    Shared_Buffer_Pool& operator=(const Shared_Buffer_Pool&) = delete;
+
+    ~Shared_Buffer_Pool();
+
+    // Returns the number of buffers.
+    std::size_t buf_count() const { return header->buf_count; }
+
+    // Returns the number of available free buffers.
+    std::size_t free_buf_count() const { return __atomic_load_n(&header->free_count, __ATOMIC_ACQUIRE); }
+
+    // Returns a free buffer, waiting for one if none is available.
+    Buffer get_buffer();
+
+    // Returns the buffer `buf` to the pool with deposited data.
+    void return_buffer(const Buffer& buf);
+
+    // Tries to fetch a data-full buffer to `buf` from the pool. Returns `true`
+    // iff such a buffer is found.
+    bool fetch_full_buf(Buffer& buf);
+
+    // Returns the buffer `buf` to the pool, to be reused later.
+    void return_free_buf(const Buffer& buf);
+
+    // Returns the current value of the full-buffer signal, to wait on with
+    // `wait_full` after finding no full buffers.
+    uint32_t full_signal() const { return header->full_signal.load(std::memory_order_acquire); }
+
+    // Waits until a buffer is returned full, or `notify_full` is invoked,
+    // after the full-buffer signal had the value `seq`.
+    void wait_full(uint32_t seq);
+
+    // Wakes the waiters for full buffers, e.g. as there is more work for them
+    // elsewhere.
+    void notify_full();
+
+    // Returns the number of buffers held by the producers, i.e. taken free and
+    // not returned full yet.
+    std::size_t held_buf_count() const;
+
+    // Returns `true` iff a buffer is held by a producer that has exited; its
+    // pairs are lost.
+    bool holder_exited() const;
+
+    // Stops accepting buffers from the producers; the ones waiting for free
+    // buffers are woken to find it closed.
+    void close();
+};
+
+
+template <typename T_key_, typename T_val_>
+inline Shared_Buffer_Pool<T_key_, T_val_>::Shared_Buffer_Pool(const std::string& path, const std::size_t buf_count, const std::size_t buf_capacity):
+    path(path),
+    owner(true)
+{
+    if(buf_count == 0 || buf_count > UINT32_MAX || buf_capacity == 0 || buf_capacity > UINT32_MAX)
+    {
+        std::cerr << "Invalid buffer configuration for the shared buffer pool. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    const std::size_t page_bytes = sysconf(_SC_PAGESIZE);
+    const std::size_t table_bytes = sizeof(Shared_Buffer_Pool_Header) + buf_count * (3 * sizeof(uint32_t) + sizeof(uint64_t));
+    const std::size_t buf_offset = (table_bytes + page_bytes - 1) / page_bytes * page_bytes;
+    const std::size_t buf_stride = (buf_capacity * sizeof(key_val_pair_t) + page_bytes - 1) / page_bytes * page_bytes;
+    region_bytes = buf_offset + buf_count * buf_stride;
+
+    unlink(path.c_str());   // Stale from an earlier channel.
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if(fd < 0 || ftruncate(fd, region_bytes) != 0)
+    {
+        std::cerr << "Error creating the shared buffer pool at " << path << ". Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    map_region(fd);
+    ::close(fd);
+
+
+    // The region is zero-filled by the truncation; the magic is written last, so that a producer attaching early
+    // finds the header incomplete rather than inconsistent.
+    header->version = shared_buffer_pool_version;
+    header->pair_size = sizeof(key_val_pair_t);
+    header->key_type_id = type_id<T_key_>();
+    header->val_type_id = type_id<T_val_>();
+    header->buf_count = buf_count;
+    header->buf_capacity = buf_capacity;
+    header->buf_offset = buf_offset;
+    header->buf_stride = buf_stride;
+    header->free_count = buf_count;
+    for(std::size_t i = 0; i < buf_count; ++i)
+        free_stack[i] = buf_count - 1 - i;
+
+    map_region(-1);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(header->magic, shared_buffer_pool_magic, sizeof(header->magic));
+}
+
+
+template <typename T_key_, typename T_val_>
+inline Shared_Buffer_Pool<T_key_, T_val_>::Shared_Buffer_Pool(const std::string& path):
+    path(path),
+    owner(false)
+{
+    const int fd = open(path.c_str(), O_RDWR);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(Shared_Buffer_Pool_Header))
+    {
+        std::cerr << "Error attaching to the shared buffer pool at " << path << ". Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    region_bytes = st.st_size;
+    map_region(fd);
+    ::close(fd);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if(std::memcmp(header->magic, shared_buffer_pool_magic, sizeof(header->magic)) != 0 || header->version != shared_buffer_pool_version)
+    {
+        std::cerr << "Unrecognized shared buffer pool format. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    if(header->pair_size != sizeof(key_val_pair_t) || header->key_type_id != type_id<T_key_>() || header->val_type_id != type_id<T_val_>())
+    {
+        std::cerr << "Shared buffer pool key-value types mismatch the requested ones. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    if(header->buf_offset + header->buf_count * header->buf_stride > region_bytes)
+    {
+        std::cerr << "Truncated shared buffer pool region. Aborting.\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    map_region(-1);
+}
+
+
+template <typename T_key_, typename T_val_>
+inline Shared_Buffer_Pool<T_key_, T_val_>::~Shared_Buffer_Pool()
+{
+    munmap(header, region_bytes);
+    if(owner)
+        unlink(path.c_str());
+}
+
+
+template <typename T_key_, typename T_val_>
+inline void Shared_Buffer_Pool<T_key_, T_val_>::map_region(const int fd)
+{
+    // With `fd` being -1, only the pointers past the header are set, once the header is valid.
+    if(fd >= 0)
+    {
+        void* const region = mmap(nullptr, region_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(region == MAP_FAILED)
+        {
+            std::cerr << "Error mapping the shared buffer pool at " << path << ". Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        header = static_cast<Shared_Buffer_Pool_Header*>(region);
+    }
+
+    free_stack = reinterpret_cast<uint32_t*>(header + 1);
+    full_ring = free_stack + header->buf_count;
+    buf_size = reinterpret_cast<uint64_t*>(full_ring + header->buf_count);
+    buf_holder = reinterpret_cast<uint32_t*>(buf_size + header->buf_count);
+    buf_base = reinterpret_cast<char*>(header) + header->buf_offset;
+}
+
+
+template <typename T_key_, typename T_val_>
+inline typename Shared_Buffer_Pool<T_key_, T_val_>::Buffer Shared_Buffer_Pool<T_key_, T_val_>::buffer(const uint32_t id, const std::size_t size) const
+{
+    return Buffer{id, reinterpret_cast<key_val_pair_t*>(buf_base + id * header->buf_stride), header->buf_capacity, size};
+}
+
+
+template <typename T_key_, typename T_val_>
+inline void Shared_Buffer_Pool<T_key_, T_val_>::lock()
+{
+    const uint32_t pid = getpid();
+    for(std::size_t attempt = 0; ; ++attempt)
+    {
+        uint32_t holder = 0;
+        if(header->lock.compare_exchange_weak(holder, pid, std::memory_order_acquire, std::memory_order_relaxed))
+            return;
+
+        if(holder == 0 || attempt < lock_spin_count)
+            continue;
+
+        if(!process_exists(holder))
+        {
+            std::cerr << "The shared buffer pool at " << path << " is locked by an exited process " << holder << ". Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        header->lock_waiters.fetch_add(1);
+        wait(header->lock, holder);
+        header->lock_waiters.fetch_sub(1);
+    }
+}
+
+
+template <typename T_key_, typename T_val_>
+inline void Shared_Buffer_Pool<T_key_, T_val_>::unlock()
+{
+    header->lock.store(0, std::memory_order_release);
+    if(header->lock_waiters.load() > 0)
+        wake(header->lock);
+}
+
+
+template <typename T_key_, typename T_val_>
+inline void Shared_Buffer_Pool<T_key_, T_val_>::wait(std::atomic<uint32_t>& signal, const uint32_t seq)
+{
+    // The futex is not private, as the region is shared across processes. It returns at once if the signal has moved.
+    const timespec timeout{1, 0};
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&signal), FUTEX_WAIT, seq, &timeout, nullptr, 0);
+}
+
+
+template <typename T_key_, typename T_val_>
+inline void Shared_Buffer_Pool<T_key_, T_val_>::wake(std::atomic<uint32_t>& signal)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&signal), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+
+template <typename T_key_, typename T_val_>
+inline typename Shared_Buffer_Pool<T_key_, T_val_>::Buffer Shared_Buffer_Pool<T_key_, T_val_>::get_buffer()
+{
+    while(true)
+    {
+        lock();
+
+        if(header->closed.load(std::memory_order_relaxed))
+        {
+            unlock();
+            std::cerr << "Deposit into a closed shared buffer pool. Aborting.\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        if(header->free_count > 0)
+        {
+            const uint32_t id = free_stack[--header->free_count];
+            __atomic_store_n(&buf_holder[id], static_cast<uint32_t>(getpid()), __ATOMIC_RELAXED);
+            unlock();
+            return buffer(id, 0);
+        }
+
+        // The signal is read under the lock, so a buffer freed after the unlock moves it and voids the wait.
+        const uint32_t seq = header->free_signal.load(std::memory_order_relaxed);
+        unlock();
+
+        header->free_waiters.fetch_add(1);
+        wait(header->free_signal, seq);
+        header->free_waiters.fetch_sub(1);
+    }
+}
+
+
+template <typename T_key_, typename T_val_>
+inline void Shared_Buffer_Pool<T_key_, T_val_>::return_buffer(const Buffer& buf)
+{
+    lock();
+    buf_size[buf.id] = buf.size;
+    __atomic_store_n(&buf_holder[buf.id], 0, __ATOMIC_RELAXED);
+    full_ring[(header->full_head + header->full_count) % header->buf_count] = buf.id;
+    header->full_count++;
+    header->full_signal.fetch_add(1, std::memory_order_relaxed);
+    unlock();
+
+    if(header->full_waiters.load() > 0)
+        wake(header->full_signal);
+}
+
+
+template <typename T_key_, typename T_val_>
+inline bool Shared_Buffer_Pool<T_key_, T_val_>::fetch_full_buf(Buffer& buf)
+{
+    if(__atomic_load_n(&header->full_count, __ATOMIC_ACQUIRE) == 0)   // Skips the lock while idle.
+        return false;
+
+    lock();
+    const bool success = (header->full_count > 0);
+    if(success)
+    {
+        const uint32_t id = full_ring[header->full_head];
+        header->full_head = (header->full_head + 1) % header->buf_count;
+        header->full_count--;
+        buf = buffer(id, buf_size[id]);
+    }
+
+    unlock();
+
+    return success;
+}
+
+
+template <typename T_key_, typename T_val_>
+inline void Shared_Buffer_Pool<T_key_, T_val_>::return_free_buf(const Buffer& buf)
+{
+    lock();
+    free_stack[header->free_count++] = buf.id;
+    header->free_signal.fetch_add(1, std::memory_order_relaxed);
+    unlock();
+
+    if(header->free_waiters.load() > 0)
+        wake(header->free_signal);
+}
+
+
+template <typename T_key_, typename T_val_>
+inline void Shared_Buffer_Pool<T_key_, T_val_>::wait_full(const uint32_t seq)
+{
+    header->full_waiters.fetch_add(1);
+    wait(header->full_signal, seq);
+    header->full_waiters.fetch_sub(1);
+}
+
+
+template <typename T_key_, typename T_val_>
+inline void Shared_Buffer_Pool<T_key_, T_val_>::notify_full()
+{
+    header->full_signal.fetch_add(1, std::memory_order_release);
+    if(header->full_waiters.load() > 0)
+        wake(header->full_signal);
+}
+
+
+template <typename T_key_, typename T_val_>
+inline std::size_t Shared_Buffer_Pool<T_key_, T_val_>::held_buf_count() const
+{
+    std::size_t count = 0;
+    for(uint32_t id = 0; id < header->buf_count; ++id)
+        count += (__atomic_load_n(&buf_holder[id], __ATOMIC_RELAXED) != 0);
+
+    return count;
+}
+
+
+template <typename T_key_, typename T_val_>
+inline bool Shared_Buffer_Pool<T_key_, T_val_>::holder_exited() const
+{
+    for(uint32_t id = 0; id < header->buf_count; ++id)
+    {
+        const uint32_t holder = __atomic_load_n(&buf_holder[id], __ATOMIC_RELAXED);
+        if(holder != 0 && !process_exists(holder))
+            return true;
+    }
+
+    return false;
+}
+
+
+template <typename T_key_, typename T_val_>
+inline void Shared_Buffer_Pool<T_key_, T_val_>::close()
+{
+    lock();
+    header->closed.store(1, std::memory_order_relaxed);
+    header->free_signal.fetch_add(1, std::memory_order_relaxed);
+    unlock();
+
+    wake(header->free_signal);
+}
+
+}
+
+
+
+#endif
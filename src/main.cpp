@@ -1,5 +1,6 @@
 
 #include "Key_Value_Collator.hpp"
+#include "Key_Value_Stream_Collator.hpp"
 
 #include <cstdint>
 #include <cstddef>
@@ -10,6 +11,105 @@
 #include <thread>
 #include <random>
 #include <chrono>
+#include <unistd.h>
+#include <sys/wait.h>
+
+
+// Deposits `buf_count` buffers of random pairs, with keys in `[0, key_max]`
+// multiplied by `key_stride`, from each of `thread_count` producers into
+// `kv_collator`, and closes its deposit stream. Returns the number of pairs
+// deposited, and appends the pairs to `deposited` if it is non-null.
+template <typename T_collator_>
+std::size_t deposit_random_pairs(T_collator_& kv_collator, const uint32_t thread_count, const uint32_t buf_count, const uint32_t key_max, const uint32_t key_stride = 1,
+                                    std::vector<typename T_collator_::key_val_pair_t>* const deposited = nullptr)
+{
+    typedef typename T_collator_::key_val_pair_t key_val_pair_t;
+    constexpr std::size_t buf_sz = 10 * 1024 * 1024; // 10MB.
+    constexpr std::size_t buf_elem = buf_sz / sizeof(key_val_pair_t);
+
+    std::vector<std::thread> worker;
+    worker.reserve(thread_count);
+    std::vector<std::vector<key_val_pair_t>> v(deposited != nullptr ? thread_count : 0);
+    for(uint32_t i = 0; i < thread_count; ++i)
+        worker.emplace_back(
+            [&kv_collator, buf_count, key_max, key_stride](std::vector<key_val_pair_t>* const pairs)
+            {
+                std::random_device rd;
+                std::mt19937 rng(rd());
+                std::uniform_int_distribution<uint32_t> uni(0, key_max);
+
+                for(uint32_t i = 0; i < buf_count; ++i)
+                {
+                    auto& buf = kv_collator.get_buffer();
+                    for(std::size_t j = 0; j < buf_elem; ++j)
+                        buf.emplace_back(uni(rng) * key_stride, uni(rng));
+
+                    if(pairs != nullptr)
+                        pairs->insert(pairs->end(), buf.cbegin(), buf.cend());
+
+                    kv_collator.return_buffer(buf);
+                }
+            },
+            deposited != nullptr ? &v[i] : nullptr
+        );
+
+    for(uint32_t i = 0; i < thread_count; ++i)
+        worker[i].join();
+
+    kv_collator.close_deposit_stream();
+
+    for(std::size_t i = 0; i < v.size() && deposited != nullptr; ++i)
+        deposited->insert(deposited->end(), v[i].cbegin(), v[i].cend());
+
+    return std::size_t(thread_count) * buf_count * buf_elem;
+}
+
+
+// Returns the number of pairs read through the iterator `it`, from its
+// position to the end of its collection.
+template <typename T_key_, typename T_val_>
+std::size_t collated_pair_count(key_value_collator::Key_Value_Iterator<T_key_, T_val_> it)
+{
+    typedef std::pair<T_key_, T_val_> key_val_pair_t;
+    constexpr std::size_t buf_mem = 10lu * 1024lu * 1024lu; // 10MB.
+    constexpr std::size_t buf_elem = buf_mem / sizeof(key_val_pair_t);
+
+    std::vector<key_val_pair_t> buf(buf_elem);
+    std::size_t pair_count = 0;
+    while(true)
+    {
+        const std::size_t read_elem = it.read(buf.data(), buf_elem);
+        if(!read_elem)
+            break;
+
+        pair_count += read_elem;
+    }
+
+    return pair_count;
+}
+
+
+// Returns the pairs read through the iterator `it`, from its position to the
+// end of its collection.
+template <typename T_key_, typename T_val_>
+std::vector<std::pair<T_key_, T_val_>> collated_pairs(key_value_collator::Key_Value_Iterator<T_key_, T_val_> it)
+{
+    typedef std::pair<T_key_, T_val_> key_val_pair_t;
+    constexpr std::size_t buf_mem = 10lu * 1024lu * 1024lu; // 10MB.
+    constexpr std::size_t buf_elem = buf_mem / sizeof(key_val_pair_t);
+
+    std::vector<key_val_pair_t> pairs;
+    std::size_t read_elem;
+    do
+    {
+        pairs.resize(pairs.size() + buf_elem);
+        read_elem = it.read(pairs.data() + pairs.size() - buf_elem, buf_elem);
+        pairs.resize(pairs.size() - buf_elem + read_elem);
+    }
+    while(read_elem > 0);
+
+    return pairs;
+}
 
 
 bool is_correct(const std::string& work_pref, const uint32_t thread_count)
@@ -214,6 +314,570 @@ bool is_correct_batched_read(const std::string& work_pref, const uint32_t thread
 }
 
 
+bool is_correct_ordered(const std::string& work_pref, const uint32_t thread_count)
+{
+    typedef uint32_t key_t;
+    typedef std::size_t val_t;
+    typedef key_value_collator::Identity_Functor<key_t> hasher_t;
+    typedef key_value_collator::Key_Value_Collator<key_t, val_t, hasher_t> kv_collator_t;
+    kv_collator_t kv_collator(work_pref, thread_count * 2);
+
+    std::vector<std::thread> worker;
+    worker.reserve(thread_count);
+    std::vector<std::vector<key_t>> v(thread_count);
+    for(uint32_t i = 0; i < thread_count; ++i)
+        worker.emplace_back(
+            [&kv_collator](std::vector<key_t>& keys)
+            {
+                constexpr uint32_t min = 0;
+                constexpr uint32_t max = std::numeric_limits<uint32_t>::max();
+
+                std::random_device rd;
+                std::mt19937 rng(rd());
+                std::uniform_int_distribution<uint32_t> uni(min, max);
+
+                constexpr std::size_t buf_sz = 10 * 1024 * 1024; // 10MB.
+                constexpr std::size_t buf_elem = buf_sz / sizeof(std::pair<key_t, val_t>);
+                kv_collator_t::buf_t& buf = kv_collator.get_buffer();
+                for(std::size_t j = 0; j < buf_elem; ++j)
+                    buf.emplace_back(uni(rd), uni(rd));
+
+                std::for_each(buf.cbegin(), buf.cend(), [&keys](const auto& p){keys.emplace_back(p.first);});
+                kv_collator.return_buffer(buf);
+            },
+            std::ref(v[i])
+        );
+
+    for(uint32_t i = 0; i < thread_count; ++i)
+        worker[i].join();
+
+    kv_collator.close_deposit_stream();
+
+    std::set<key_t> s;
+    std::for_each(v.cbegin(), v.cend(), [&s](const auto& vec)
+        { std::for_each(vec.cbegin(), vec.cend(), [&s](const auto p){ s.insert(p); }); });
+    std::cout << "Unique keys deposited: " << s.size() << "\n";
+
+    kv_collator.collate(thread_count);
+
+
+    // The keys must come out in sorted order, without sorting them again.
+    kv_collator_t::ordered_iter_t it = kv_collator.ordered_begin();
+    const kv_collator_t::ordered_iter_t end = kv_collator.ordered_end();
+    std::vector<key_t> vec_it;
+    while(it != end)
+    {
+        vec_it.emplace_back(*it);
+        ++it;
+    }
+
+    std::cout << "Iterated over unique-key count: " << vec_it.size() << "\n";
+
+    return vec_it == std::vector<key_t>(s.cbegin(), s.cend());
+}
+
+
+bool is_correct_spill_tier(const std::string& work_pref, const uint32_t thread_count)
+{
+    typedef uint32_t key_t;
+    typedef std::size_t val_t;
+    typedef key_value_collator::Identity_Functor<key_t> hasher_t;
+    typedef key_value_collator::Key_Value_Collator<key_t, val_t, hasher_t> kv_collator_t;
+    kv_collator_t kv_collator(work_pref, thread_count * 2);
+
+    // A tier of a few partition buffers, with the spills throttled, overflows while the spills of the partitions
+    // are still queued.
+    constexpr std::size_t tier_cap = 16lu * 1024lu * 1024lu;
+    kv_collator.set_spill_tier(work_pref + ".tier", tier_cap);
+    kv_collator.set_io_rate_limits(0, 128lu * 1024lu * 1024lu);
+
+    const std::size_t deposited = deposit_random_pairs(kv_collator, thread_count, 2, 63);
+    const std::size_t deposited_bytes = deposited * sizeof(kv_collator_t::key_val_pair_t);
+    std::cout << "Pairs deposited: " << deposited << "\n";
+
+    // The spills fill the tier up and overflow the rest into the work directory, all through the write limit, which
+    // holds them back past its burst.
+    const auto residency = kv_collator.spill_residency();
+    const auto spill_stats = kv_collator.io_stats();
+    std::cout << "Bytes spilled into the tier: " << residency.fast_bytes << ", into the work directory: " << residency.disk_bytes
+              << ", throttled for " << spill_stats.write_throttle_time << " s\n";
+    const bool spilled = (residency.fast_bytes > 0 && residency.fast_bytes <= tier_cap && residency.disk_bytes > 0 &&
+                          residency.fast_bytes + residency.disk_bytes == deposited_bytes &&
+                          spill_stats.bytes_written == deposited_bytes && spill_stats.write_throttle_time > 0);
+
+    kv_collator.collate(thread_count, true);
+
+    const std::size_t collated = collated_pair_count(kv_collator.begin());
+    std::cout << "Pairs collated: " << kv_collator.pair_count() << ", iterated over: " << collated << "\n";
+
+    return spilled && kv_collator.io_stats().bytes_written == 2 * deposited_bytes &&
+           kv_collator.pair_count() == deposited && collated == deposited;
+}
+
+
+bool is_correct_split(const std::string& work_pref, const uint32_t thread_count)
+{
+    typedef uint32_t key_t;
+    typedef std::size_t val_t;
+    typedef key_value_collator::Identity_Functor<key_t> hasher_t;
+    typedef key_value_collator::Key_Value_Collator<key_t, val_t, hasher_t> kv_collator_t;
+    kv_collator_t kv_collator(work_pref, thread_count * 2);
+
+    // All the keys fall into a single partition, which is split into child runs by the hash bits above its ID.
+    kv_collator.set_partition_split_threshold(16lu * 1024lu * 1024lu);
+
+    std::vector<kv_collator_t::key_val_pair_t> deposited;
+    deposit_random_pairs(kv_collator, thread_count, 2, 4095, 512, &deposited);
+    std::cout << "Pairs deposited: " << deposited.size() << "\n";
+
+    kv_collator.collate(thread_count, true);
+
+    // The hot partition, being the whole collation, comes out sorted by the keys, with the pairs deposited.
+    std::vector<kv_collator_t::key_val_pair_t> collated = collated_pairs(kv_collator.begin());
+    std::cout << "Pairs collated: " << kv_collator.pair_count() << ", iterated over: " << collated.size() << "\n";
+
+    const bool sorted = std::is_sorted(collated.cbegin(), collated.cend(),
+                                        [](const auto& lhs, const auto& rhs){ return lhs.first < rhs.first; });
+    std::sort(deposited.begin(), deposited.end());
+    std::sort(collated.begin(), collated.end());
+
+    return sorted && kv_collator.pair_count() == deposited.size() && collated == deposited;
+}
+
+
+bool is_correct_mapped(const std::string& work_pref, const uint32_t thread_count)
+{
+    typedef uint32_t key_t;
+    typedef std::size_t val_t;
+    typedef key_value_collator::Identity_Functor<key_t> hasher_t;
+    typedef key_value_collator::Key_Value_Collator<key_t, val_t, hasher_t> kv_collator_t;
+    kv_collator_t kv_collator(work_pref, thread_count * 2);
+
+    // All the keys fall into a single partition, mapped into the tier till it is full and then into the work
+    // directory, and split into child runs, whose last windows are left partially filled.
+    constexpr std::size_t tier_cap = 4lu * 1024lu * 1024lu;
+    kv_collator.set_spill_mode(kv_collator_t::Spill_Mode::mapped);
+    kv_collator.set_spill_tier(work_pref + ".tier", tier_cap);
+    kv_collator.set_partition_split_threshold(4lu * 1024lu * 1024lu);
+
+    std::vector<kv_collator_t::key_val_pair_t> deposited;
+    deposit_random_pairs(kv_collator, thread_count, 2, 4095, 512, &deposited);
+    std::cout << "Pairs deposited: " << deposited.size() << "\n";
+
+    // The trimmed windows are not counted as spilled.
+    const auto residency = kv_collator.spill_residency();
+    std::cout << "Bytes spilled into the tier: " << residency.fast_bytes << ", into the work directory: " << residency.disk_bytes << "\n";
+    const bool spilled = (residency.fast_bytes > 0 && residency.fast_bytes <= tier_cap &&
+                          residency.fast_bytes + residency.disk_bytes == deposited.size() * sizeof(kv_collator_t::key_val_pair_t));
+
+    kv_collator.collate(thread_count, true);
+
+    std::vector<kv_collator_t::key_val_pair_t> collated = collated_pairs(kv_collator.begin());
+    std::cout << "Pairs collated: " << kv_collator.pair_count() << ", iterated over: " << collated.size() << "\n";
+
+    const bool sorted = std::is_sorted(collated.cbegin(), collated.cend(),
+                                        [](const auto& lhs, const auto& rhs){ return lhs.first < rhs.first; });
+    std::sort(deposited.begin(), deposited.end());
+    std::sort(collated.begin(), collated.end());
+
+    return spilled && sorted && kv_collator.pair_count() == deposited.size() && collated == deposited;
+}
+
+
+bool is_correct_reset(const std::string& work_pref, const uint32_t thread_count)
+{
+    typedef uint32_t key_t;
+    typedef std::size_t val_t;
+    typedef key_value_collator::Identity_Functor<key_t> hasher_t;
+    typedef key_value_collator::Key_Value_Collator<key_t, val_t, hasher_t> kv_collator_t;
+    kv_collator_t kv_collator(work_pref, thread_count * 2);
+    kv_collator.set_partition_split_threshold(16lu * 1024lu * 1024lu);
+
+    // The first round splits a single hot partition; the second spreads over the partitions, with other keys.
+    const std::size_t first = deposit_random_pairs(kv_collator, thread_count, 2, 4095, 512);
+    kv_collator.collate(thread_count, true);
+    std::cout << "Pairs collated in the first round: " << kv_collator.pair_count() << " of " << first << "\n";
+    const bool first_collated = (kv_collator.pair_count() == first);
+
+    kv_collator.reset();
+    const bool aggregates_reset = (kv_collator.pair_count() == 0 && kv_collator.unique_key_count() == 0 && kv_collator.mode_frequency() == 0);
+
+    std::vector<kv_collator_t::key_val_pair_t> deposited;
+    deposit_random_pairs(kv_collator, thread_count, 1, 65535, 3, &deposited);
+    kv_collator.collate(thread_count, true);
+
+    std::vector<kv_collator_t::key_val_pair_t> collated = collated_pairs(kv_collator.begin());
+    std::cout << "Pairs collated in the second round: " << kv_collator.pair_count() << ", iterated over: " << collated.size()
+              << " of " << deposited.size() << "\n";
+
+    std::sort(deposited.begin(), deposited.end());
+    std::sort(collated.begin(), collated.end());
+    const bool second_collated = (kv_collator.pair_count() == deposited.size() && collated == deposited);
+
+    // Only the keys of the second round are counted.
+    const std::size_t unique_key_count = std::unique(deposited.begin(), deposited.end(),
+                                                     [](const auto& lhs, const auto& rhs){ return lhs.first == rhs.first; }) - deposited.begin();
+
+    return first_collated && aggregates_reset && second_collated && kv_collator.unique_key_count() == unique_key_count;
+}
+
+
+bool is_correct_persisted(const std::string& work_pref, const uint32_t thread_count)
+{
+    typedef uint32_t key_t;
+    typedef std::size_t val_t;
+    typedef key_value_collator::Identity_Functor<key_t> hasher_t;
+    typedef key_value_collator::Key_Value_Collator<key_t, val_t, hasher_t> kv_collator_t;
+    const std::string manifest_path(work_pref + ".manifest");
+
+    std::size_t deposited;
+    {
+        kv_collator_t kv_collator(work_pref, thread_count * 2);
+        deposited = deposit_random_pairs(kv_collator, thread_count, 2, std::numeric_limits<uint32_t>::max());
+        std::cout << "Pairs deposited: " << deposited << "\n";
+
+        kv_collator.collate(thread_count);
+        kv_collator.persist(manifest_path);
+    }
+
+    // A later collator at the same path-prefix reclaims the working files, but not the persisted collation.
+    {
+        kv_collator_t kv_collator(work_pref, thread_count * 2);
+        deposit_random_pairs(kv_collator, thread_count, 1, std::numeric_limits<uint32_t>::max());
+        kv_collator.collate(thread_count);
+    }
+
+    const kv_collator_t::dataset_t dataset(manifest_path);
+    const std::size_t persisted = collated_pair_count(dataset.begin());
+    std::cout << "Pairs persisted: " << dataset.pair_count() << ", iterated over: " << persisted << "\n";
+
+    for(const std::string& path : dataset.collation_layout()->path)
+        if(!path.empty())
+            std::remove(path.c_str());
+    std::remove(manifest_path.c_str());
+
+    return dataset.pair_count() == deposited && persisted == deposited;
+}
+
+
+bool is_correct_incremental(const std::string& work_pref, const uint32_t thread_count)
+{
+    typedef uint32_t key_t;
+    typedef std::size_t val_t;
+    typedef key_value_collator::Identity_Functor<key_t> hasher_t;
+    typedef key_value_collator::Key_Value_Collator<key_t, val_t, hasher_t> kv_collator_t;
+    kv_collator_t kv_collator(work_pref, thread_count * 2);
+
+    std::vector<kv_collator_t::key_val_pair_t> deposited;
+    deposit_random_pairs(kv_collator, thread_count, 2, (1 << 20), 1, &deposited);
+    kv_collator.collate(thread_count, true);
+
+    // The pairs of the reopened stream are merged into the collated partitions, and the aggregates recomputed.
+    kv_collator.reopen_deposit_stream();
+    deposit_random_pairs(kv_collator, thread_count, 1, (1 << 20), 1, &deposited);
+    std::cout << "Pairs deposited: " << deposited.size() << "\n";
+
+    kv_collator.collate(thread_count, true);
+
+    std::vector<kv_collator_t::key_val_pair_t> collated = collated_pairs(kv_collator.begin());
+    std::cout << "Pairs collated: " << kv_collator.pair_count() << ", iterated over: " << collated.size() << "\n";
+
+    std::sort(deposited.begin(), deposited.end());
+    std::sort(collated.begin(), collated.end());
+    std::size_t unique_key_count = 0;
+    for(std::size_t i = 0; i < deposited.size(); ++i)
+        unique_key_count += (i == 0 || deposited[i].first != deposited[i - 1].first);
+
+    return kv_collator.pair_count() == deposited.size() && kv_collator.unique_key_count() == unique_key_count && collated == deposited;
+}
+
+
+bool is_correct_resumed(const std::string& work_pref, const uint32_t thread_count)
+{
+    typedef uint32_t key_t;
+    typedef std::size_t val_t;
+    typedef key_value_collator::Identity_Functor<key_t> hasher_t;
+    typedef key_value_collator::Key_Value_Collator<key_t, val_t, hasher_t> kv_collator_t;
+
+    // A forked process deposits with checkpointing on and exits without destructing its collator, as if it had
+    // crashed, leaving the deposits and the checkpoint behind; it reports its deposited pair count back.
+    int count_pipe[2];
+    if(pipe(count_pipe) != 0)
+        return false;
+
+    const pid_t pid = fork();
+    if(pid < 0)
+        return false;
+
+    if(pid == 0)
+    {
+        kv_collator_t* const kv_collator = new kv_collator_t(work_pref, thread_count * 2, kv_collator_t::Checkpoint_Mode::on);
+        const std::size_t deposited = deposit_random_pairs(*kv_collator, thread_count, 2, std::numeric_limits<uint32_t>::max());
+        _exit(write(count_pipe[1], &deposited, sizeof(deposited)) == sizeof(deposited) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    std::size_t deposited;
+    const bool received = (read(count_pipe[0], &deposited, sizeof(deposited)) == sizeof(deposited));
+    int status;
+    waitpid(pid, &status, 0);
+    close(count_pipe[0]), close(count_pipe[1]);
+    if(!received || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS || !kv_collator_t::checkpoint_exists(work_pref))
+        return false;
+
+    std::cout << "Pairs deposited: " << deposited << "\n";
+
+    kv_collator_t kv_collator(work_pref, thread_count * 2, kv_collator_t::Checkpoint_Mode::resume);
+    kv_collator.collate(thread_count, true);
+
+    const std::size_t collated = collated_pair_count(kv_collator.begin());
+    std::cout << "Pairs collated: " << kv_collator.pair_count() << ", iterated over: " << collated << "\n";
+
+    return kv_collator.pair_count() == deposited && collated == deposited;
+}
+
+
+bool is_correct_exchanged(const std::string& work_pref, const uint32_t thread_count)
+{
+    typedef uint32_t key_t;
+    typedef std::size_t val_t;
+    typedef key_value_collator::Identity_Functor<key_t> hasher_t;
+    typedef key_value_collator::Key_Value_Collator<key_t, val_t, hasher_t> kv_collator_t;
+    constexpr std::size_t process_count = 2;
+
+    // A forked process takes rank 1 of the exchange and reports its deposited and collated pair counts back.
+    int count_pipe[2];
+    if(pipe(count_pipe) != 0)
+        return false;
+
+    // The output so far is flushed, so that the child does not flush its copy of it again as it exits.
+    std::cout.flush();
+    const pid_t pid = fork();
+    if(pid < 0)
+        return false;
+
+    const std::size_t rank = (pid == 0 ? 1 : 0);
+    std::size_t count[2];   // Pairs deposited to and collated at this process.
+    {
+        kv_collator_t kv_collator(work_pref + "." + std::to_string(rank), thread_count * 2);
+        kv_collator.set_partition_exchange(work_pref + ".exchange", process_count, rank);
+
+        count[0] = deposit_random_pairs(kv_collator, thread_count, 2, std::numeric_limits<uint32_t>::max());
+        kv_collator.collate(thread_count, true);
+        count[1] = collated_pair_count(kv_collator.begin());
+    }
+
+    // The child exits normally, so that its pending removals of working files complete.
+    if(pid == 0)
+        std::exit(write(count_pipe[1], count, sizeof(count)) == sizeof(count) ? EXIT_SUCCESS : EXIT_FAILURE);
+
+    std::size_t peer_count[2];
+    const bool received = (read(count_pipe[0], peer_count, sizeof(peer_count)) == sizeof(peer_count));
+    int status;
+    waitpid(pid, &status, 0);
+    close(count_pipe[0]), close(count_pipe[1]);
+    if(!received || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+        return false;
+
+    std::cout << "Pairs deposited: " << count[0] + peer_count[0] << "\n";
+    std::cout << "Pairs collated: " << count[1] << " + " << peer_count[1] << "\n";
+
+    return count[0] + peer_count[0] == count[1] + peer_count[1];
+}
+
+
+bool is_correct_shared_channel(const std::string& work_pref, const uint32_t thread_count)
+{
+    typedef uint32_t key_t;
+    typedef std::size_t val_t;
+    typedef key_value_collator::Identity_Functor<key_t> hasher_t;
+    typedef key_value_collator::Key_Value_Collator<key_t, val_t, hasher_t> kv_collator_t;
+    typedef key_value_collator::Shared_Buffer_Pool<key_t, val_t> shared_pool_t;
+    constexpr std::size_t producer_pair_count = 20lu * 1024lu * 1024lu / sizeof(kv_collator_t::key_val_pair_t);  // 20MB.
+    const std::string channel_path(work_pref + ".channel");
+
+    kv_collator_t kv_collator(work_pref, thread_count * 2);
+    kv_collator.open_shared_deposit_channel(channel_path);
+
+    // Forked producers deposit through the shared pool, alongside the producer threads of this process.
+    std::vector<pid_t> pid;
+    for(uint32_t i = 0; i < thread_count; ++i)
+    {
+        pid.push_back(fork());
+        if(pid.back() < 0)
+            return false;
+
+        if(pid.back() == 0)
+        {
+            shared_pool_t shared_pool(channel_path);
+            std::random_device rd;
+            std::mt19937 rng(rd());
+            std::uniform_int_distribution<uint32_t> uni(0, std::numeric_limits<uint32_t>::max());
+
+            std::size_t pair_count = 0;
+            while(pair_count < producer_pair_count)
+            {
+                auto buf = shared_pool.get_buffer();
+                for(; !buf.full() && pair_count < producer_pair_count; ++pair_count)
+                    buf.push_back(kv_collator_t::key_val_pair_t(uni(rng), uni(rng)));
+
+                shared_pool.return_buffer(buf);
+            }
+
+            _exit(EXIT_SUCCESS);
+        }
+    }
+
+    bool producers_done = true;
+    for(const pid_t p : pid)
+    {
+        int status;
+        waitpid(p, &status, 0);
+        producers_done = producers_done && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+    }
+
+    const std::size_t deposited = deposit_random_pairs(kv_collator, thread_count, 2, std::numeric_limits<uint32_t>::max()) +
+                                    thread_count * producer_pair_count;
+    std::cout << "Pairs deposited: " << deposited << "\n";
+
+    kv_collator.collate(thread_count, true);
+
+    const std::size_t collated = collated_pair_count(kv_collator.begin());
+    std::cout << "Pairs collated: " << kv_collator.pair_count() << ", iterated over: " << collated << "\n";
+
+    return producers_done && kv_collator.pair_count() == deposited && collated == deposited;
+}
+
+
+bool is_correct_shared_scan(const std::string& work_pref, const uint32_t thread_count)
+{
+    typedef uint32_t key_t;
+    typedef std::size_t val_t;
+    typedef key_value_collator::Identity_Functor<key_t> hasher_t;
+    typedef key_value_collator::Key_Value_Collator<key_t, val_t, hasher_t> kv_collator_t;
+    kv_collator_t kv_collator(work_pref, thread_count * 2);
+
+    deposit_random_pairs(kv_collator, thread_count, 2, std::numeric_limits<uint32_t>::max());
+    kv_collator.collate(thread_count);
+
+    const std::vector<kv_collator_t::key_val_pair_t> collated = collated_pairs(kv_collator.begin());
+    std::cout << "Pairs collated: " << collated.size() << "\n";
+
+    // Each consumer visits every chunk of the scan, in the order of the collation.
+    kv_collator_t::shared_scan_t scan(kv_collator, thread_count);
+    std::vector<std::vector<kv_collator_t::key_val_pair_t>> scanned(thread_count);
+    std::vector<std::thread> worker;
+    worker.reserve(thread_count);
+    for(uint32_t i = 0; i < thread_count; ++i)
+        worker.emplace_back(
+            [&scan](std::vector<kv_collator_t::key_val_pair_t>& pairs)
+            {
+                kv_collator_t::shared_scan_t::Cursor cursor(scan);
+                const kv_collator_t::key_val_pair_t* data;
+                std::size_t count;
+                while((count = cursor.next(data)) > 0)
+                    pairs.insert(pairs.end(), data, data + count);
+            },
+            std::ref(scanned[i])
+        );
+
+    for(uint32_t i = 0; i < thread_count; ++i)
+        worker[i].join();
+
+    for(uint32_t i = 0; i < thread_count; ++i)
+    {
+        std::cout << "Pairs scanned by consumer " << i << ": " << scanned[i].size() << "\n";
+        if(scanned[i] != collated)
+            return false;
+    }
+
+    return true;
+}
+
+
+bool is_correct_streamed(const std::string& work_pref, const uint32_t thread_count)
+{
+    typedef uint32_t key_t;
+    typedef std::size_t val_t;
+    typedef key_value_collator::Identity_Functor<key_t> hasher_t;
+    typedef key_value_collator::Key_Value_Stream_Collator<key_t, val_t, hasher_t> kv_stream_collator_t;
+    typedef kv_stream_collator_t::collator_t::key_val_pair_t key_val_pair_t;
+    kv_stream_collator_t kv_stream_collator(work_pref, thread_count * 2, thread_count);
+
+    // The producers deposit while the epochs are rotated under them.
+    std::atomic<uint32_t> producing(thread_count);
+    std::vector<std::thread> worker;
+    worker.reserve(thread_count);
+    std::vector<std::vector<key_val_pair_t>> v(thread_count);
+    for(uint32_t i = 0; i < thread_count; ++i)
+        worker.emplace_back(
+            [&kv_stream_collator, &producing](std::vector<key_val_pair_t>& pairs)
+            {
+                std::random_device rd;
+                std::mt19937 rng(rd());
+                std::uniform_int_distribution<uint32_t> uni(0, std::numeric_limits<uint32_t>::max());
+
+                constexpr std::size_t buf_elem = 64 * 1024;
+                for(uint32_t i = 0; i < 32; ++i)    // Each producer deposits 32 buffers.
+                {
+                    kv_stream_collator_t::buf_t& buf = kv_stream_collator.get_buffer();
+                    for(std::size_t j = 0; j < buf_elem; ++j)
+                        buf.emplace_back(uni(rng), uni(rng));
+
+                    pairs.insert(pairs.end(), buf.cbegin(), buf.cend());
+                    kv_stream_collator.return_buffer(buf);
+                }
+
+                producing--;
+            },
+            std::ref(v[i])
+        );
+
+    while(producing > 0)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        kv_stream_collator.rotate();
+    }
+
+    for(uint32_t i = 0; i < thread_count; ++i)
+        worker[i].join();
+
+    const std::size_t last = kv_stream_collator.rotate();
+
+    std::vector<key_val_pair_t> deposited;
+    for(const auto& pairs : v)
+        deposited.insert(deposited.end(), pairs.cbegin(), pairs.cend());
+    std::cout << "Pairs deposited: " << deposited.size() << "\n";
+
+    // The epochs hold the pairs deposited, each once, and their merge comes out sorted by the keys.
+    std::vector<key_val_pair_t> collated = collated_pairs(kv_stream_collator_t::iter_t(kv_stream_collator.collation_layout(0, last)));
+    std::cout << "Pairs collated over " << last + 1 << " epochs: " << collated.size() << "\n";
+
+    kv_stream_collator_t::ordered_iter_t it = kv_stream_collator.ordered_begin(0, last);
+    std::vector<key_val_pair_t> merged(64 * 1024);
+    std::size_t merged_count = 0;
+    key_t prev_key = 0;
+    bool sorted = true;
+    std::size_t read_elem;
+    while((read_elem = it.read(merged.data(), merged.size())) > 0)
+    {
+        for(std::size_t i = 0; i < read_elem; ++i)
+        {
+            sorted = sorted && (merged_count + i == 0 || prev_key <= merged[i].first);
+            prev_key = merged[i].first;
+        }
+
+        merged_count += read_elem;
+    }
+
+    sorted = sorted && merged_count == collated.size();
+
+    std::sort(deposited.begin(), deposited.end());
+    std::sort(collated.begin(), collated.end());
+
+    return sorted && collated == deposited;
+}
+
+
 int main(int argc, char* argv[])
 {
     (void)argc;
@@ -226,5 +890,29 @@ int main(int argc, char* argv[])
 
     // std::cout << "Collated collection is " << (is_correct_batched_read(work_pref, thread_count) ? "correct" : "incorrect") << "\n";
 
+    std::cout << "Sorted-order iteration is " << (is_correct_ordered(work_pref, thread_count) ? "correct" : "incorrect") << "\n";
+
+    std::cout << "Shared scan is " << (is_correct_shared_scan(work_pref, thread_count) ? "correct" : "incorrect") << "\n";
+
+    std::cout << "Streamed collation is " << (is_correct_streamed(work_pref, thread_count) ? "correct" : "incorrect") << "\n";
+
+    std::cout << "Spill-tiered collation is " << (is_correct_spill_tier(work_pref, thread_count) ? "correct" : "incorrect") << "\n";
+
+    std::cout << "Split collation is " << (is_correct_split(work_pref, thread_count) ? "correct" : "incorrect") << "\n";
+
+    std::cout << "Mapped collation is " << (is_correct_mapped(work_pref, thread_count) ? "correct" : "incorrect") << "\n";
+
+    std::cout << "Reset collation is " << (is_correct_reset(work_pref, thread_count) ? "correct" : "incorrect") << "\n";
+
+    std::cout << "Persisted collation is " << (is_correct_persisted(work_pref, thread_count) ? "correct" : "incorrect") << "\n";
+
+    std::cout << "Incremental collation is " << (is_correct_incremental(work_pref, thread_count) ? "correct" : "incorrect") << "\n";
+
+    std::cout << "Resumed collation is " << (is_correct_resumed(work_pref, thread_count) ? "correct" : "incorrect") << "\n";
+
+    std::cout << "Exchanged collation is " << (is_correct_exchanged(work_pref, thread_count) ? "correct" : "incorrect") << "\n";
+
+    std::cout << "Shared-channel collation is " << (is_correct_shared_channel(work_pref, thread_count) ? "correct" : "incorrect") << "\n";
+
     return 0;
 }